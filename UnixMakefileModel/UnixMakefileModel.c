@@ -18,58 +18,201 @@ int main(int argc, char* argv[]) {
 
 	int errSeen = 0;
 	FILE *aMakeFile;
-	char *aTargetFile = NULL;
+	char **goals = malloc(argc * sizeof(char *));
+	int goalCount = 0;
 
-	int needFree = 0;
+	char *makeFileName = "myMakefile";
 	int openFile = 0;
+	int useDb = 1;
+	int watch = 0;
+	char *traceName = NULL;
+	struct timespec start;
 
-	int tempIndex = 0;
+	if (goals == NULL) {
+		fprintf(stderr, "Ran Out of Memory.\n");
+		return 1;
+	}
+
+	int tempIndex = 1;
 	while (tempIndex < argc) {
 		if (strcmp(argv[tempIndex], "-f") == 0) {
 			openFile++;
+			// More than one -f options.
+			if (openFile > 1) {
+				fprintf(stderr, "Too many File (-f) options were Given.\n");
+				free(goals);
+				return 1;
+			}
+			if (tempIndex + 1 >= argc) {
+				fprintf(stderr, "No File was Given after -f.\n");
+				free(goals);
+				return 1;
+			}
+			makeFileName = argv[++tempIndex];
+		} else if (strcmp(argv[tempIndex], "--trace") == 0) {
+			if (tempIndex + 1 >= argc) {
+				fprintf(stderr, "No File was Given after --trace.\n");
+				free(goals);
+				return 1;
+			}
+			traceName = argv[++tempIndex];
+		} else if (strcmp(argv[tempIndex], "--action-cache") == 0) {
+			if (tempIndex + 1 >= argc) {
+				fprintf(stderr, "No Directory was Given after --action-cache.\n");
+				free(goals);
+				return 1;
+			}
+			actionCacheDir = argv[++tempIndex];
+		} else if (strcmp(argv[tempIndex], "--action-cache-size") == 0) {
+			if (tempIndex + 1 >= argc || (actionCacheLimit = atol(argv[tempIndex + 1])) < 1) {
+				fprintf(stderr, "Invalid Action Cache Size was Given.\n");
+				free(goals);
+				return 1;
+			}
+			tempIndex++;
+		} else if (strcmp(argv[tempIndex], "--mem-floor") == 0) {
+			if (tempIndex + 1 >= argc || (memoryFloor = atol(argv[tempIndex + 1])) < 1) {
+				fprintf(stderr, "Invalid Memory Floor was Given.\n");
+				free(goals);
+				return 1;
+			}
+			tempIndex++;
+		} else if (strcmp(argv[tempIndex], "--proc-dir") == 0) {
+			if (tempIndex + 1 >= argc) {
+				fprintf(stderr, "No Directory was Given after --proc-dir.\n");
+				free(goals);
+				return 1;
+			}
+			procDir = argv[++tempIndex];
+		} else if (strcmp(argv[tempIndex], "--shell") == 0) {
+			shellOnly = 1;
+		} else if (strcmp(argv[tempIndex], "--one-shell") == 0) {
+			oneShell = 1;
+		} else if (strcmp(argv[tempIndex], "--no-capture") == 0) {
+			captureOutput = 0;
+		} else if (strcmp(argv[tempIndex], "--stream-output") == 0) {
+			streamOutput = 1;
+		} else if (strcmp(argv[tempIndex], "--spawn-stats") == 0) {
+			spawnStats = 1;
+		} else if (strcmp(argv[tempIndex], "--stat-stats") == 0) {
+			statStats = 1;
+		} else if (strcmp(argv[tempIndex], "--watch") == 0) {
+			watch = 1;
+		} else if (strcmp(argv[tempIndex], "--hash") == 0) {
+			useHash = 1;
+		} else if (strcmp(argv[tempIndex], "--no-db") == 0) {
+			useDb = 0;
+		} else if (strcmp(argv[tempIndex], "--no-mmap") == 0) {
+			useMmap = 0;
+		} else if (strcmp(argv[tempIndex], "--no-lazy") == 0) {
+			useLazyParse = 0;
+		} else if (strcmp(argv[tempIndex], "--no-graph-cache") == 0) {
+			useGraphCache = 0;
+		} else if (strcmp(argv[tempIndex], "--no-prefetch") == 0) {
+			usePrefetch = 0;
+		} else if (strcmp(argv[tempIndex], "--no-io-uring") == 0) {
+			useIoUring = 0;
+		} else if (strncmp(argv[tempIndex], "-l", 2) == 0) {
+			char *load = argv[tempIndex] + 2;
+
+			if (*load == 0 && tempIndex + 1 < argc) {
+				load = argv[++tempIndex];
+			}
+			maxLoad = atof(load);
+			if (maxLoad <= 0) {
+				fprintf(stderr, "Invalid Load Limit (-l) was Given.\n");
+				free(goals);
+				return 1;
+			}
+		} else if (strncmp(argv[tempIndex], "-j", 2) == 0) {
+			char *count = argv[tempIndex] + 2;
+
+			if (*count == 0 && tempIndex + 1 < argc) {
+				count = argv[++tempIndex];
+			}
+			jobSlots = atoi(count);
+			if (jobSlots < 1) {
+				fprintf(stderr, "Invalid Job Count (-j) was Given.\n");
+				free(goals);
+				return 1;
+			}
+		} else {
+			goals[goalCount++] = argv[tempIndex];
 		}
 		tempIndex++;
 	}
 
-	// More than one -f options.
-	if (openFile > 1) {
-		fprintf(stderr, "Too many File (-f) options were Given.\n");
+	// Hashes only decide staleness through the records of the build database.
+	if (useHash && !useDb) {
+		fprintf(stderr, "--hash Needs the Build Database and Cannot be Used with --no-db.\n");
+		free(goals);
 		return 1;
-	} else if (openFile == 1) {
-
-		if (argc > 4) {
-			fprintf(stderr, "Too many Arguemnts were Given.\n");
-			return 1;
-		}
+	}
 
-		aMakeFile = fopen(argv[2], "r");
-	} else {
-		// Needs to open myMakeFile;
-		aMakeFile = fopen("myMakefile", "r"); 
+	if (traceName != NULL) {
+		openTrace(traceName);
 	}
+
+	aMakeFile = fopen(makeFileName, "r");
 	
 	
 	if (aMakeFile == NULL) {
 		fprintf(stderr, "Could not Open aMakeFile.\n");
+		free(goals);
 		return 1;
 	}
 
-	errSeen += parseMakeFileData(aMakeFile);
+	if (useDb) {
+		setBuildDatabase(makeFileName);
+	}
+
+	// Only parse the rules the goals need, or the whole makefile if there is no
+	// compiled graph for this exact makefile. A graph that covers every rule is
+	// compiled either way.
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if (!watch && parseGoals(makeFileName, aMakeFile, goals, goalCount)) {
+		tracePhase("parse reachable rules", &start);
+
+		if (!partialGraph) {
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			saveGraphCache(makeFileName, aMakeFile);
+			tracePhase("save graph cache", &start);
+		}
+	} else if (loadGraphCache(makeFileName, aMakeFile)) {
+		tracePhase("load graph cache", &start);
+	} else {
+		errSeen += parseMakeFileData(aMakeFile);
+		tracePhase("parse makefile", &start);
 
-	if (openFile && (argc > 3)) {
-                aTargetFile = argv[3];
-        } else {
-		aTargetFile = strdup(targetNode);
-		needFree = 1;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		saveGraphCache(makeFileName, aMakeFile);
+		tracePhase("save graph cache", &start);
 	}
 
-	errSeen += parseTargetFileData(aTargetFile);
-	
-	if (needFree) {
-		free(aTargetFile);
+	// With no goals given, build the first target of the makefile.
+	char *defaultGoal = NULL;
+	if (goalCount == 0) {
+		if (targetNode == NULL) {
+			fprintf(stderr, "No Targets were Found in the Makefile.\n");
+			freeLL();
+			free(goals);
+			return 1;
+		}
+		defaultGoal = strdup(targetNode);
+		goals[goalCount++] = defaultGoal;
 	}
 
+	if (watch) {
+		errSeen += watchGoals(makeFileName, goals, goalCount);
+	} else {
+		errSeen += parseTargetFileData(goals, goalCount);
+	}
+	
+	free(defaultGoal);
+	free(goals);
+
 	fclose(aMakeFile);
+	setBuildDatabase(NULL);
 
 	return errSeen >= 1;
 }
\ No newline at end of file
@@ -0,0 +1,378 @@
+/*
+* File: actionCache.c
+* Author: Chance Krueger
+* Purpose: Defines the action cache behind `--action-cache DIR`. A
+* target's recipe and the contents of its prerequisites decide what
+* the recipe produces, so they are hashed into a key, and the output
+* of every recipe that succeeds is kept in DIR under that key, as a
+* read-only copy. When the same key comes up again, here or in another
+* checkout sharing DIR, the output is restored from DIR (by reflink or
+* copy) instead of running the recipe. An output never shares its inode
+* with an entry, so rewriting the output in place cannot change the
+* entry. DIR is kept under a size limit by
+* deleting the entries used longest ago, and the hits and misses of
+* each build are reported at its end.
+*/
+
+
+# include "header.h"
+# include <errno.h>
+# include <fcntl.h>
+# include <dirent.h>
+# include <unistd.h>
+# include <sys/ioctl.h>
+# include <linux/fs.h>
+
+#define KEY_LEN 16
+#define COPY_BUFFER (64 * 1024)
+
+/*
+ * struct cacheEntry -- One file of the cache directory, as seen when evicting.
+ * Stores its name (`name`), size (`size`) and when it was last used (`used`).
+ */
+struct cacheEntry {
+	char name[KEY_LEN + 1];
+	off_t size;
+	struct timespec used;
+};
+
+// GLOBAL VARIBLES
+char *actionCacheDir = NULL;
+long actionCacheLimit = 1024;
+
+static long cacheHits = 0;
+static long cacheMisses = 0;
+static long cacheStored = 0;
+static long cacheEvicted = 0;
+static long cacheUnstamped = 0;
+
+
+/*
+ * entryPath(key, suffix) -- Returns a new string with the path of the cache entry
+ * for `key`, followed by `suffix`.
+ */
+static char *entryPath(unsigned long key, const char *suffix) {
+
+	char *path = malloc(strlen(actionCacheDir) + KEY_LEN + strlen(suffix) + 2);
+
+	if (path == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	sprintf(path, "%s/%016lx%s", actionCacheDir, key, suffix);
+	return path;
+}
+
+
+/*
+ * copyFile(from, to, writable) -- Makes `to` a copy of `from`, sharing its blocks through
+ * a reflink when the file system supports it. `to` gets the permissions of `from` without
+ * any write bits, or, if `writable` is set, with the write bits the umask allows.
+ * Returns `1` on success and `0` on failure, leaving no partial `to` behind.
+ */
+static int copyFile(const char *from, const char *to, int writable) {
+
+	int in = open(from, O_RDONLY);
+	struct stat fileData;
+
+	if (in < 0 || fstat(in, &fileData) != 0) {
+		if (in >= 0) {
+			close(in);
+		}
+		return 0;
+	}
+
+	mode_t mask = umask(0);
+	umask(mask);
+
+	mode_t mode = fileData.st_mode & 0555;
+	if (writable) {
+		mode |= 0222 & ~mask;
+	}
+
+	int out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+	int ok = out >= 0;
+
+	if (ok && ioctl(out, FICLONE, in) != 0) {
+		char buffer[COPY_BUFFER];
+		ssize_t got;
+
+		while (ok && (got = read(in, buffer, sizeof(buffer))) > 0) {
+			ok = write(out, buffer, got) == got;
+		}
+		ok = ok && got == 0;
+	}
+
+	close(in);
+	if (ok && fchmod(out, mode) != 0) {
+		ok = 0;
+	}
+	if (out >= 0 && close(out) != 0) {
+		ok = 0;
+	}
+	if (!ok && out >= 0) {
+		unlink(to);
+	}
+	return ok;
+}
+
+
+/*
+ * placeFile(from, to, temp, writable) -- Makes `to` a new file holding the contents of
+ * `from`, as `copyFile` does. The file is made under the name `temp`, next to `to`, and
+ * renamed over `to`, so `to` is never seen half written. It is never a hard link: a later
+ * rewrite of one file in place would change the other too. Returns `1` on success and `0`
+ * on failure.
+ */
+static int placeFile(const char *from, const char *to, const char *temp, int writable) {
+
+	unlink(temp);
+	if (!copyFile(from, temp, writable)) {
+		return 0;
+	}
+	if (rename(temp, to) != 0) {
+		unlink(temp);
+		return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * openActionCache() -- Creates the cache directory if needed and starts the counts
+ * of a new build. Turns the cache off if the directory cannot be used.
+ */
+void openActionCache() {
+
+	cacheHits = 0;
+	cacheMisses = 0;
+	cacheStored = 0;
+	cacheEvicted = 0;
+	cacheUnstamped = 0;
+
+	if (actionCacheDir == NULL) {
+		return;
+	}
+	if (mkdir(actionCacheDir, 0777) != 0 && errno != EEXIST) {
+		perror(actionCacheDir);
+		actionCacheDir = NULL;
+	}
+}
+
+
+/*
+ * actionKey(id, key) -- Computes the cache key of node `id` into `key`: a hash of its
+ * name, its recipe lines and the name and content hash of each prerequisite, in order.
+ * Returns `1` if the node can be cached, or `0` if the cache is off, the node is phony
+ * or not a target, or a prerequisite is phony or has no contents to hash.
+ */
+int actionKey(int id, unsigned long *key) {
+
+	struct parentNode *node = graph.nodes[id];
+	int edge;
+
+	if (actionCacheDir == NULL || graph.flags[id].phony || !graph.flags[id].target) {
+		return 0;
+	}
+
+	unsigned long hash = hashName(node->name, strlen(node->name) + 1);
+	unsigned long recipe = recipeHash(node);
+
+	hash = hashBytes(hash, &recipe, sizeof(recipe));
+
+	for (edge = graph.childStart[id]; edge < graph.childStart[id + 1]; edge++) {
+		int child = graph.childIds[edge];
+		unsigned long content;
+
+		if (graph.flags[child].phony || !contentHashOf(child, &content)) {
+			return 0;
+		}
+		hash = hashBytes(hash, graph.nodes[child]->name, strlen(graph.nodes[child]->name) + 1);
+		hash = hashBytes(hash, &content, sizeof(content));
+	}
+	*key = hash;
+	return 1;
+}
+
+
+/*
+ * markUsed(key, path) -- Marks the cache entry for `key` at `path` as just used by setting
+ * its mtime, which eviction goes by. Only the owner of an entry may set its times, so an
+ * entry another user stored in a shared directory is replaced by a fresh copy of itself
+ * instead. Where that is not allowed either (a directory with the sticky bit), the entry
+ * keeps the time it was stored and is counted in `cacheUnstamped`.
+ */
+static void markUsed(unsigned long key, const char *path) {
+
+	if (utimensat(AT_FDCWD, path, NULL, 0) == 0) {
+		return;
+	}
+
+	char suffix[32];
+
+	snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+	char *temp = entryPath(key, suffix);
+
+	if (!placeFile(path, path, temp, 0)) {
+		cacheUnstamped++;
+	}
+	free(temp);
+}
+
+
+/*
+ * restoreAction(id, key) -- Restores the output of node `id` from the cache entry for
+ * `key`, if there is one, and marks the entry as just used with `markUsed`. The restored output is
+ * newer than its prerequisites, like one the recipe just wrote. Returns `1` on a hit
+ * and `0` on a miss.
+ */
+int restoreAction(int id, unsigned long key) {
+
+	char *path = entryPath(key, "");
+	char *name = graph.nodes[id]->name;
+	char *temp = malloc(strlen(name) + sizeof(".mymake_tmp"));
+	int hit = 0;
+
+	if (temp == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	sprintf(temp, "%s.mymake_tmp", name);
+
+	if (access(path, F_OK) == 0 && placeFile(path, name, temp, 1)) {
+		markUsed(key, path);
+		utimensat(AT_FDCWD, name, NULL, 0);
+		hit = 1;
+	}
+
+	hit ? cacheHits++ : cacheMisses++;
+	free(temp);
+	free(path);
+	return hit;
+}
+
+
+/*
+ * storeAction(id, key) -- Keeps a read-only copy of the output of node `id`, whose recipe
+ * just succeeded, as the cache entry for `key`. Nothing is stored if the recipe made no
+ * regular file.
+ */
+void storeAction(int id, unsigned long key) {
+
+	struct stat fileData;
+	char *name = graph.nodes[id]->name;
+
+	if (lstat(name, &fileData) != 0 || !S_ISREG(fileData.st_mode)) {
+		return;
+	}
+
+	char *path = entryPath(key, "");
+	char suffix[32];
+
+	// Builds sharing the directory each write their own temporary file.
+	snprintf(suffix, sizeof(suffix), ".%d.tmp", (int)getpid());
+	char *temp = entryPath(key, suffix);
+
+	if (placeFile(name, path, temp, 0)) {
+		cacheStored++;
+	}
+	free(temp);
+	free(path);
+}
+
+
+/*
+ * compareUsed(first, second) -- Orders cache entries from the one used longest ago.
+ */
+static int compareUsed(const void *first, const void *second) {
+
+	return compareTime(((const struct cacheEntry *)first)->used, ((const struct cacheEntry *)second)->used);
+}
+
+
+/*
+ * evictEntries() -- Deletes the entries used longest ago until the cache directory
+ * holds no more than `actionCacheLimit` megabytes. Temporary files are left alone.
+ * Returns how many bytes the cache holds afterwards.
+ */
+static long long evictEntries() {
+
+	DIR *dir = opendir(actionCacheDir);
+	struct dirent *item;
+	struct cacheEntry *entries = NULL;
+	size_t count = 0;
+	size_t size = 0;
+	long long total = 0;
+
+	if (dir == NULL) {
+		return 0;
+	}
+
+	while ((item = readdir(dir)) != NULL) {
+		struct stat fileData;
+
+		if (strlen(item->d_name) != KEY_LEN || strspn(item->d_name, "0123456789abcdef") != KEY_LEN
+				|| fstatat(dirfd(dir), item->d_name, &fileData, AT_SYMLINK_NOFOLLOW) != 0) {
+			continue;
+		}
+		if (count == size) {
+			size = size ? size * 2 : 256;
+			entries = realloc(entries, size * sizeof(struct cacheEntry));
+
+			if (entries == NULL) {
+				closedir(dir);
+				freeLL();
+				fprintf(stderr, "Ran Out of Memory.\n");
+				exit(1);
+			}
+		}
+		memcpy(entries[count].name, item->d_name, KEY_LEN + 1);
+		entries[count].size = fileData.st_size;
+		entries[count].used = fileData.st_mtim;
+		total += fileData.st_size;
+		count++;
+	}
+
+	long long limit = (long long)actionCacheLimit * 1024 * 1024;
+	size_t index;
+
+	if (total > limit) {
+		qsort(entries, count, sizeof(struct cacheEntry), compareUsed);
+
+		for (index = 0; index < count && total > limit; index++) {
+			if (unlinkat(dirfd(dir), entries[index].name, 0) == 0) {
+				total -= entries[index].size;
+				cacheEvicted++;
+			}
+		}
+	}
+	closedir(dir);
+	free(entries);
+	return total;
+}
+
+
+/*
+ * closeActionCache() -- Ends a build with the cache on: keeps the directory under its
+ * size limit if anything was stored, and prints the hits and misses of the build, and
+ * how many hit entries kept their store time as their last use (see `markUsed`).
+ */
+void closeActionCache() {
+
+	if (actionCacheDir == NULL) {
+		return;
+	}
+
+	long long total = cacheStored > 0 ? evictEntries() : -1;
+
+	fprintf(stderr, "action cache hits %ld, misses %ld, stored %ld", cacheHits, cacheMisses, cacheStored);
+	if (total >= 0) {
+		fprintf(stderr, ", evicted %ld, %.1f of %ld MB used", cacheEvicted, total / 1048576.0, actionCacheLimit);
+	}
+	if (cacheUnstamped > 0) {
+		fprintf(stderr, ", %ld hits could not be marked as used", cacheUnstamped);
+	}
+	fputc('\n', stderr);
+}
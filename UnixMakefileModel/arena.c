@@ -0,0 +1,103 @@
+/*
+* File: arena.c
+* Author: Chance Krueger
+* Purpose: Defines the bump arena that every part of the dependency
+* graph is allocated from: `parentNode`, `childNode` and `LineNode`
+* structures, interned names, recipe lines and build records. Memory
+* is handed out from large chunks by moving a pointer, and the whole
+* graph is released by `arenaFree()` in one call instead of one
+* `free()` per node, edge and line.
+*/
+
+
+# include "header.h"
+
+#define ARENA_CHUNK_SIZE (1024 * 1024)
+#define ARENA_ALIGN 16
+
+/*
+ * struct arenaChunk -- One block of arena memory. Stores the next chunk
+ * (`next`), how many bytes are in use (`used`) and how many there are
+ * (`size`). The memory itself follows the header.
+ */
+struct arenaChunk {
+	struct arenaChunk *next;
+	size_t used;
+	size_t size;
+};
+
+// GLOBAL VARIBLES
+long arenaChunks = 0;
+
+static struct arenaChunk *chunks = NULL;
+
+
+/*
+ * arenaAlloc(size) -- Returns `size` bytes of uninitialized memory from the arena.
+ * Starts a new chunk when the current one is full; requests larger than a
+ * chunk get a chunk of their own. Exits if memory allocation fails.
+ */
+void *arenaAlloc(size_t size) {
+
+	size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+	if (chunks == NULL || chunks->used + size > chunks->size) {
+		size_t chunkSize = size > ARENA_CHUNK_SIZE ? size : ARENA_CHUNK_SIZE;
+		size_t header = (sizeof(struct arenaChunk) + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+		struct arenaChunk *chunk = malloc(header + chunkSize);
+
+		if (chunk == NULL) {
+			arenaFree();
+			fprintf(stderr, "Ran Out of Memory.\n");
+			exit(1);
+		}
+		chunk->used = header;
+		chunk->size = header + chunkSize;
+		chunk->next = chunks;
+		chunks = chunk;
+		arenaChunks++;
+	}
+
+	void *memory = (char *)chunks + chunks->used;
+	chunks->used += size;
+	return memory;
+}
+
+
+/*
+ * arenaZalloc(size) -- Returns `size` bytes of zeroed memory from the arena.
+ */
+void *arenaZalloc(size_t size) {
+
+	return memset(arenaAlloc(size), 0, size);
+}
+
+
+/*
+ * arenaStrndup(text, len) -- Copies the first `len` bytes of `text` into the
+ * arena and null-terminates the copy.
+ */
+char *arenaStrndup(const char *text, size_t len) {
+
+	char *copy = arenaAlloc(len + 1);
+
+	memcpy(copy, text, len);
+	copy[len] = 0;
+	return copy;
+}
+
+
+/*
+ * arenaFree() -- Releases every chunk of the arena at once.
+ * All memory returned by the arena is invalid afterwards.
+ */
+void arenaFree() {
+
+	while (chunks != NULL) {
+		struct arenaChunk *next = chunks->next;
+
+		free(chunks);
+		chunks = next;
+	}
+	arenaChunks = 0;
+}
@@ -0,0 +1,619 @@
+/*
+* File: benchGraph.c
+* Author: Chance Krueger
+* Purpose: Synthetic makefile generator and benchmark suite. Writes
+* makefiles of six shapes (wide fan-out, deep chain, stacked
+* diamonds, heavy fan-in, long recipe lists and a slow chain beside
+* fast targets) together with real
+* source and target files, so that every target is up to date and
+* any source can be touched to force a rebuild. For each shape and
+* size it times parsing (`parseMakeFileData`), the traversal (`POT`,
+* which also stats every node), the no-op scheduling pass (`runJobs`)
+* and a second traversal with every stat cached separately, records
+* how many bytes the graph takes per node, prints a table, and writes
+* one CSV row per measurement so that results can be compared between
+* versions. `--schedule` instead really builds the slow-chain shape in
+* parallel, once without and then with recorded recipe durations, to
+* time how long the build takes with each scheduling order.
+*
+* Usage: benchGraph [maxTargets] [results.csv]
+*        benchGraph --generate shape targets directory
+*        benchGraph --schedule [targets] [jobs]
+*/
+
+
+#define _GNU_SOURCE
+# include "header.h"
+# include <unistd.h>
+# include <fcntl.h>
+# include <ftw.h>
+# include <sys/stat.h>
+
+#define FANIN_SHARED 100
+#define RECIPE_LINES 20
+#define REPEATS 3
+#define SKEW_FAST "0.02"
+#define SKEW_SLOW "0.1"
+#define SCHEDULE_RUNS 3
+
+/*
+ * struct shape -- One makefile shape. Stores its name (`name`) and the
+ * function that writes a makefile of that shape with `targets` targets.
+ */
+struct shape {
+	const char *name;
+	void (*write)(FILE *fp, int targets);
+};
+
+
+/*
+ * writeFanOut(fp, targets) -- `all` depends directly on every target,
+ * and every target on its own source file.
+ */
+void writeFanOut(FILE *fp, int targets) {
+
+	int index;
+
+	fputs("all :", fp);
+	for (index = 0; index < targets; index++) {
+		fprintf(fp, " obj/t%d.o", index);
+	}
+	fputs("\n\ttouch all\n", fp);
+
+	for (index = 0; index < targets; index++) {
+		fprintf(fp, "obj/t%d.o : src/s%d.c\n\ttouch obj/t%d.o\n", index, index, index);
+	}
+}
+
+
+/*
+ * writeChain(fp, targets) -- Every target depends on the one before it and
+ * on its own source file, so the graph is one path `targets` nodes deep.
+ */
+void writeChain(FILE *fp, int targets) {
+
+	int index;
+
+	fprintf(fp, "all : obj/t%d.o\n\ttouch all\n", targets - 1);
+	for (index = 0; index < targets; index++) {
+		fprintf(fp, "obj/t%d.o : src/s%d.c", index, index);
+		if (index > 0) {
+			fprintf(fp, " obj/t%d.o", index - 1);
+		}
+		fprintf(fp, "\n\ttouch obj/t%d.o\n", index);
+	}
+}
+
+
+/*
+ * writeDiamond(fp, targets) -- Stacks diamonds: two targets both depend on
+ * the previous join, and the next join depends on both of them. Every node
+ * is reached along two paths.
+ */
+void writeDiamond(FILE *fp, int targets) {
+
+	int joins = targets / 3 > 0 ? targets / 3 : 1;
+	int index;
+
+	fprintf(fp, "all : obj/j%d.o\n\ttouch all\n", joins - 1);
+	fputs("obj/j0.o : src/s0.c\n\ttouch obj/j0.o\n", fp);
+	for (index = 1; index < joins; index++) {
+		fprintf(fp, "obj/l%d.o : obj/j%d.o\n\ttouch obj/l%d.o\n", index, index - 1, index);
+		fprintf(fp, "obj/r%d.o : obj/j%d.o\n\ttouch obj/r%d.o\n", index, index - 1, index);
+		fprintf(fp, "obj/j%d.o : obj/l%d.o obj/r%d.o src/s%d.c\n\ttouch obj/j%d.o\n",
+				index, index, index, index, index);
+	}
+}
+
+
+/*
+ * writeFanIn(fp, targets) -- Every target depends on its own source file and
+ * on the same shared headers, so a few nodes have a very large number of dependents.
+ */
+void writeFanIn(FILE *fp, int targets) {
+
+	int index;
+
+	fputs("all :", fp);
+	for (index = 0; index < targets; index++) {
+		fprintf(fp, " obj/t%d.o", index);
+	}
+	fputs("\n\ttouch all\n", fp);
+
+	for (index = 0; index < targets; index++) {
+		fprintf(fp, "obj/t%d.o : src/s%d.c", index, index);
+
+		int shared;
+		for (shared = 0; shared < FANIN_SHARED; shared++) {
+			fprintf(fp, " src/h%d.h", shared);
+		}
+		fprintf(fp, "\n\ttouch obj/t%d.o\n", index);
+	}
+}
+
+
+/*
+ * writeRecipes(fp, targets) -- Like `writeFanOut`, but every target has a
+ * recipe of `RECIPE_LINES` lines.
+ */
+void writeRecipes(FILE *fp, int targets) {
+
+	int index;
+
+	fputs("all :", fp);
+	for (index = 0; index < targets; index++) {
+		fprintf(fp, " obj/t%d.o", index);
+	}
+	fputs("\n\ttouch all\n", fp);
+
+	for (index = 0; index < targets; index++) {
+		fprintf(fp, "obj/t%d.o : src/s%d.c\n", index, index);
+
+		int line;
+		for (line = 0; line < RECIPE_LINES - 1; line++) {
+			fprintf(fp, "\techo step %d of obj/t%d.o > /dev/null\n", line, index);
+		}
+		fprintf(fp, "\ttouch obj/t%d.o\n", index);
+	}
+}
+
+
+/*
+ * writeSkewed(fp, targets) -- `all` depends on a fan of fast targets and, listed last,
+ * on the end of a chain of `targets / 10` slow ones. Post-order reaches the chain last,
+ * although it decides how long a parallel build of `all` takes.
+ */
+void writeSkewed(FILE *fp, int targets) {
+
+	int chain = targets / 10 > 0 ? targets / 10 : 1;
+	int index;
+
+	fputs("all :", fp);
+	for (index = 0; index < targets - chain; index++) {
+		fprintf(fp, " obj/t%d.o", index);
+	}
+	fprintf(fp, " obj/c%d.o\n\ttouch all\n", chain - 1);
+
+	for (index = 0; index < targets - chain; index++) {
+		fprintf(fp, "obj/t%d.o : src/s%d.c\n\tsleep " SKEW_FAST "\n\ttouch obj/t%d.o\n", index, index, index);
+	}
+	for (index = 0; index < chain; index++) {
+		fprintf(fp, "obj/c%d.o : src/c%d.c", index, index);
+		if (index > 0) {
+			fprintf(fp, " obj/c%d.o", index - 1);
+		}
+		fprintf(fp, "\n\tsleep " SKEW_SLOW "\n\ttouch obj/c%d.o\n", index);
+	}
+}
+
+
+static struct shape shapes[] = {
+	{"fanout", writeFanOut},
+	{"chain", writeChain},
+	{"diamond", writeDiamond},
+	{"fanin", writeFanIn},
+	{"recipes", writeRecipes},
+	{"skewed", writeSkewed},
+};
+
+#define SHAPE_COUNT ((int)(sizeof(shapes) / sizeof(shapes[0])))
+
+
+/*
+ * touchFile(path, base, rank) -- Creates the empty file `path` with an mtime of `base`
+ * plus `rank` nanoseconds. Exits if the file cannot be created.
+ */
+void touchFile(char *path, struct timespec base, long rank) {
+
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+	if (fd < 0) {
+		perror(path);
+		exit(1);
+	}
+
+	struct timespec times[2];
+	times[0].tv_sec = base.tv_sec + (base.tv_nsec + rank) / 1000000000;
+	times[0].tv_nsec = (base.tv_nsec + rank) % 1000000000;
+	times[1] = times[0];
+	futimens(fd, times);
+	close(fd);
+}
+
+
+/*
+ * stampTargets(dir, now) -- Gives every target under `dir` an mtime of `now` plus its
+ * position in a post-order walk of the graph, in nanoseconds, so that every target is
+ * newer than all of its prerequisites. Returns the number of targets stamped.
+ */
+long stampTargets(char *dir, struct timespec now) {
+
+	int *edges = malloc(graphSize * sizeof(int));
+	int *stack = malloc(graphSize * sizeof(int));
+	char path[4096];
+	long rank = 0;
+	int root;
+
+	if (edges == NULL || stack == NULL) {
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+
+	for (root = 0; root < graphSize; root++) {
+		if (graph.flags[root].visited) {
+			continue;
+		}
+
+		int depth = 0;
+		graph.flags[root].visited = 1;
+		edges[root] = graph.childStart[root];
+		stack[depth++] = root;
+
+		while (depth > 0) {
+			int id = stack[depth - 1];
+
+			if (edges[id] == graph.childStart[id + 1]) {
+				if (graph.flags[id].target) {
+					snprintf(path, sizeof(path), "%s/%s", dir, graph.nodes[id]->name);
+					touchFile(path, now, rank++);
+				}
+				depth--;
+				continue;
+			}
+			int child = graph.childIds[edges[id]++];
+
+			if (!graph.flags[child].visited) {
+				graph.flags[child].visited = 1;
+				edges[child] = graph.childStart[child];
+				stack[depth++] = child;
+			}
+		}
+	}
+
+	free(edges);
+	free(stack);
+	return rank;
+}
+
+
+/*
+ * generateTree(dir, shape, targets) -- Writes `dir/Makefile` of the given shape and creates
+ * every file it names: prerequisites that are not targets are made an hour old, and targets
+ * are made now, so the whole tree is up to date. Returns the number of files created.
+ */
+long generateTree(char *dir, struct shape *shape, int targets) {
+
+	char path[4096];
+
+	snprintf(path, sizeof(path), "%s/src", dir);
+	mkdir(path, 0755);
+	snprintf(path, sizeof(path), "%s/obj", dir);
+	mkdir(path, 0755);
+
+	snprintf(path, sizeof(path), "%s/Makefile", dir);
+	FILE *fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror(path);
+		exit(1);
+	}
+	shape->write(fp, targets);
+	fclose(fp);
+
+	// Parse the makefile just written to learn which files it names.
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		perror(path);
+		exit(1);
+	}
+	parseMakeFileData(fp);
+	fclose(fp);
+
+	struct timespec now;
+	struct timespec old;
+	struct parentNode *cur;
+	long files = 0;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	old = now;
+	old.tv_sec -= 3600;
+
+	for (cur = headLL; cur != NULL; cur = cur->next) {
+		if (!graph.flags[cur->id].target) {
+			snprintf(path, sizeof(path), "%s/%s", dir, cur->name);
+			touchFile(path, old, 0);
+			files++;
+		}
+	}
+	files += stampTargets(dir, now);
+	freeLL();
+	return files;
+}
+
+
+/*
+ * removeEntry(path, data, type, ftw) -- `nftw` callback that deletes one file or directory.
+ */
+int removeEntry(const char *path, const struct stat *data, int type, struct FTW *ftw) {
+
+	(void)data;
+	(void)type;
+	(void)ftw;
+	return remove(path);
+}
+
+
+/*
+ * resetTraversal() -- Clears what the traversal and the scheduler set on every node,
+ * but keeps the stat results, so that the next `POT` measures the walk alone.
+ */
+void resetTraversal() {
+
+	int id;
+
+	for (id = 0; id < graphSize; id++) {
+		graph.flags[id].visited = 0;
+		graph.flags[id].completed = 0;
+		graph.flags[id].mustBuild = 0;
+		graph.pending[id] = 0;
+	}
+	memset(graph.dropped, 0, graph.edgeCount);
+}
+
+
+/*
+ * benchTree(makeFile, times, nodes, edges, bytes) -- Parses `makeFile`, traverses it from
+ * its first target, runs the scheduler once and traverses it again with the stats cached,
+ * storing the time of each phase in `times` in nanoseconds, the size of the graph in `nodes`
+ * and `edges`, and the bytes it takes (see `graphBytes`) in `bytes`. Exits if any recipe
+ * ran, since the tree is meant to be up to date.
+ */
+void benchTree(char *makeFile, double times[4], long *nodes, long *edges, long *bytes) {
+
+	struct timespec start;
+	FILE *fp = fopen(makeFile, "r");
+
+	if (fp == NULL) {
+		perror(makeFile);
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	parseMakeFileData(fp);
+	times[0] = elapsedNanos(&start);
+	fclose(fp);
+
+	*nodes = graphSize;
+	*edges = graph.edgeCount;
+	*bytes = graphBytes();
+	int goal = verifyTargetNode(targetNode)->id;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	POT(goal);
+	times[1] = elapsedNanos(&start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	runJobs();
+	times[2] = elapsedNanos(&start);
+
+	resetTraversal();
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	POT(goal);
+	times[3] = elapsedNanos(&start);
+	runJobs();
+
+	freeLL();
+
+	if (CMDSused) {
+		fprintf(stderr, "%s was not up to date.\n", makeFile);
+		exit(1);
+	}
+}
+
+
+/*
+ * generateOnly(shapeName, targets, dir) -- Implements `--generate`: writes one tree into `dir`.
+ */
+int generateOnly(char *shapeName, int targets, char *dir) {
+
+	int index;
+
+	for (index = 0; index < SHAPE_COUNT; index++) {
+		if (strcmp(shapes[index].name, shapeName) == 0) {
+			mkdir(dir, 0755);
+			long files = generateTree(dir, &shapes[index], targets);
+			printf("Wrote %s/Makefile (%s, %d targets, %ld files).\n", dir, shapeName, targets, files);
+			return 0;
+		}
+	}
+	fprintf(stderr, "Unknown shape %s.\n", shapeName);
+	return 1;
+}
+
+
+/*
+ * timeBuild() -- Parses `Makefile` in the current directory, deletes every target it names
+ * and builds its first target with the build database on, with the printed commands sent
+ * to /dev/null. Returns how long the build took in nanoseconds. Exits if a recipe fails.
+ */
+double timeBuild() {
+
+	struct timespec start;
+	FILE *fp = fopen("Makefile", "r");
+
+	if (fp == NULL) {
+		perror("Makefile");
+		exit(1);
+	}
+	parseMakeFileData(fp);
+	fclose(fp);
+
+	int id;
+	for (id = 0; id < graphSize; id++) {
+		if (graph.flags[id].target) {
+			unlink(graph.nodes[id]->name);
+		}
+	}
+
+	struct parentNode *goal = verifyTargetNode(targetNode);
+	int quiet = open("/dev/null", O_WRONLY);
+	int saved = dup(STDOUT_FILENO);
+
+	fflush(stdout);
+	dup2(quiet, STDOUT_FILENO);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int failed = buildGoals(&goal, 1);
+	double took = elapsedNanos(&start);
+	fflush(stdout);
+	dup2(saved, STDOUT_FILENO);
+	close(saved);
+	close(quiet);
+	freeLL();
+
+	if (failed) {
+		fprintf(stderr, "A recipe failed.\n");
+		exit(1);
+	}
+	return took;
+}
+
+
+/*
+ * scheduleOnly(targets, jobs) -- Implements `--schedule`: builds a skewed tree of `targets`
+ * targets from scratch with `jobs` slots `SCHEDULE_RUNS` times. The first build has no
+ * recorded durations and runs ready targets in post-order; the later ones order them by
+ * the longest timed path. Prints the time of the first build and the best later one.
+ */
+int scheduleOnly(int targets, int jobs) {
+
+	char dir[] = "/tmp/benchGraphXXXXXX";
+	char cwd[4096];
+
+	if (targets < 1 || jobs < 1 || getcwd(cwd, sizeof(cwd)) == NULL || mkdtemp(dir) == NULL) {
+		fprintf(stderr, "Cannot set up the schedule benchmark.\n");
+		return 1;
+	}
+	generateTree(dir, &shapes[SHAPE_COUNT - 1], targets);
+	if (chdir(dir) != 0) {
+		perror(dir);
+		return 1;
+	}
+	setBuildDatabase("Makefile");
+	jobSlots = jobs;
+
+	double first = timeBuild();
+	double best = 0;
+	int run;
+
+	for (run = 1; run < SCHEDULE_RUNS; run++) {
+		double took = timeBuild();
+
+		if (run == 1 || took < best) {
+			best = took;
+		}
+	}
+
+	if (chdir(cwd) != 0) {
+		perror(cwd);
+		return 1;
+	}
+	nftw(dir, removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+
+	printf("skewed, %d targets, -j%d:\n", targets, jobs);
+	printf("  post-order (no durations yet) %8.1f ms\n", first / 1e6);
+	printf("  longest timed path first      %8.1f ms (%.0f%% shorter)\n", best / 1e6, 100 * (1 - best / first));
+	return 0;
+}
+
+
+/*
+ * main(argc, argv) -- Runs every shape at sizes 10^2 up to `maxTargets` (default 10^5),
+ * keeping the best of `REPEATS` runs of each phase, generates a single tree, or times
+ * parallel builds for `--schedule`.
+ */
+int main(int argc, char *argv[]) {
+
+	if (argc == 5 && strcmp(argv[1], "--generate") == 0) {
+		return generateOnly(argv[2], atoi(argv[3]), argv[4]);
+	}
+	if (argc >= 2 && argc <= 4 && strcmp(argv[1], "--schedule") == 0) {
+		return scheduleOnly(argc > 2 ? atoi(argv[2]) : 100, argc > 3 ? atoi(argv[3]) : 4);
+	}
+	if (argc > 3 || (argc > 1 && argv[1][0] == '-')) {
+		fprintf(stderr, "Usage: %s [maxTargets] [results.csv]\n", argv[0]);
+		fprintf(stderr, "       %s --generate shape targets directory\n", argv[0]);
+		fprintf(stderr, "       %s --schedule [targets] [jobs]\n", argv[0]);
+		return 1;
+	}
+
+	long maxTargets = argc > 1 ? atol(argv[1]) : 100000;
+	char *csvName = argc > 2 ? argv[2] : "benchGraph.csv";
+	FILE *csv = fopen(csvName, "w");
+
+	if (csv == NULL) {
+		perror(csvName);
+		return 1;
+	}
+	fprintf(csv, "shape,targets,nodes,edges,parse_ms,traverse_ms,noop_ms,retraverse_ms,bytes_per_node\n");
+
+	char cwd[4096];
+	if (getcwd(cwd, sizeof(cwd)) == NULL) {
+		perror("getcwd");
+		return 1;
+	}
+
+	printf("%8s %8s %9s %9s %11s %13s %10s %15s %10s\n", "shape", "targets", "nodes", "edges",
+			"parse (ms)", "traverse (ms)", "noop (ms)", "retraverse (ms)", "bytes/node");
+
+	int index;
+	for (index = 0; index < SHAPE_COUNT; index++) {
+		long targets;
+
+		for (targets = 100; targets <= maxTargets; targets *= 10) {
+			char dir[] = "/tmp/benchGraphXXXXXX";
+
+			if (mkdtemp(dir) == NULL) {
+				perror("mkdtemp");
+				return 1;
+			}
+			generateTree(dir, &shapes[index], targets);
+
+			// Names in the makefile are relative to its directory.
+			if (chdir(dir) != 0) {
+				perror(dir);
+				return 1;
+			}
+
+			double best[4] = {0, 0, 0, 0};
+			long nodes = 0, edges = 0, bytes = 0;
+			int repeat;
+
+			for (repeat = 0; repeat < REPEATS; repeat++) {
+				double times[4];
+				int phase;
+
+				benchTree("Makefile", times, &nodes, &edges, &bytes);
+				for (phase = 0; phase < 4; phase++) {
+					if (repeat == 0 || times[phase] < best[phase]) {
+						best[phase] = times[phase];
+					}
+				}
+			}
+
+			if (chdir(cwd) != 0) {
+				perror(cwd);
+				return 1;
+			}
+			nftw(dir, removeEntry, 64, FTW_DEPTH | FTW_PHYS);
+
+			printf("%8s %8ld %9ld %9ld %11.2f %13.2f %10.2f %15.2f %10.1f\n", shapes[index].name, targets,
+					nodes, edges, best[0] / 1e6, best[1] / 1e6, best[2] / 1e6, best[3] / 1e6, (double)bytes / nodes);
+			fprintf(csv, "%s,%ld,%ld,%ld,%.3f,%.3f,%.3f,%.3f,%.1f\n", shapes[index].name, targets,
+					nodes, edges, best[0] / 1e6, best[1] / 1e6, best[2] / 1e6, best[3] / 1e6, (double)bytes / nodes);
+			fflush(stdout);
+		}
+	}
+
+	fclose(csv);
+	printf("Results written to %s.\n", csvName);
+	return 0;
+}
@@ -0,0 +1,235 @@
+/*
+* File: benchParse.c
+* Author: Chance Krueger
+* Purpose: Scaling benchmark for `parseMakeFileData`. Generates
+* makefiles of 1k to 100k targets, each with ten prerequisites
+* (half earlier targets, half source files) and a one line recipe,
+* then times how long parsing takes with the `getline` parser and
+* with the memory-mapped parser, and how long loading the same graph
+* from the compiled-graph cache takes. With the target table the time per
+* target should stay flat as the makefile grows. A second table does
+* the same for very long names and for one rule whose prerequisite
+* line is several megabytes long, and a third for rules with 10k
+* prerequisites each, some of them listed twice, as generated
+* dependency files produce.
+*/
+
+
+# include "header.h"
+# include <unistd.h>
+
+#define PREREQS 10
+#define FANIN_PREREQS 10000
+#define FANIN_HEADERS 20000
+
+
+/*
+ * writeMakeFile(fp, targets) -- Writes a synthetic makefile with `targets` rules to `fp`.
+ * Every rule depends on five earlier targets and five source files so that
+ * both the lookup and the insert paths are exercised.
+ */
+void writeMakeFile(FILE *fp, int targets) {
+
+	int index;
+	for (index = 0; index < targets; index++) {
+		fprintf(fp, "obj/t%d.o :", index);
+
+		int dep;
+		for (dep = 0; dep < PREREQS / 2; dep++) {
+			if (index > dep) {
+				fprintf(fp, " obj/t%d.o", (index * 7 + dep) % index);
+			}
+			fprintf(fp, " src/s%d_%d.c", index, dep);
+		}
+		fprintf(fp, "\n\tgcc -c src/t%d.c -o obj/t%d.o\n", index, index);
+	}
+}
+
+
+/*
+ * writeLongName(fp, index, len) -- Writes a path-like name of exactly `len` characters.
+ */
+void writeLongName(FILE *fp, int index, int len) {
+
+	int written = fprintf(fp, "build/out/linux-x86_64/release/obj/%08d/", index);
+
+	while (written < len - 2) {
+		fputc('a' + (written % 26), fp);
+		written++;
+	}
+	fputs(".o", fp);
+}
+
+
+/*
+ * writeLongMakeFile(fp, targets, nameLen, lineBytes) -- Writes `targets` rules whose
+ * names are `nameLen` characters long, each depending on the one before it, then one
+ * `all` rule whose prerequisite line lists long names until it is `lineBytes` long.
+ */
+void writeLongMakeFile(FILE *fp, int targets, int nameLen, long lineBytes) {
+
+	int index;
+	for (index = 0; index < targets; index++) {
+		writeLongName(fp, index, nameLen);
+		fputs(" :", fp);
+		if (index > 0) {
+			fputc(' ', fp);
+			writeLongName(fp, index - 1, nameLen);
+		}
+		fputs("\n\ttouch $@\n", fp);
+	}
+
+	fputs("all :", fp);
+	long written = 0;
+	for (index = 0; written < lineBytes; index++) {
+		fputc(' ', fp);
+		writeLongName(fp, index, nameLen);
+		written += nameLen + 1;
+	}
+	fputc('\n', fp);
+}
+
+
+/*
+ * writeFanInMakeFile(fp, rules) -- Writes `rules` rules that each list `FANIN_PREREQS`
+ * headers out of a shared pool of `FANIN_HEADERS`. Every tenth prerequisite repeats
+ * one listed earlier in the same rule, so duplicates are rejected all along the line.
+ */
+void writeFanInMakeFile(FILE *fp, int rules) {
+
+	int index;
+	for (index = 0; index < rules; index++) {
+		fprintf(fp, "obj/t%d.o :", index);
+
+		int dep;
+		for (dep = 0; dep < FANIN_PREREQS; dep++) {
+			int header = dep % 10 == 9 ? dep / 2 : dep;
+
+			fprintf(fp, " include/h%d.h", (header + index * 97) % FANIN_HEADERS);
+		}
+		fprintf(fp, "\n\tgcc -c src/t%d.c -o obj/t%d.o\n", index, index);
+	}
+}
+
+
+/*
+ * timeParse(fp, mapped) -- Parses `fp` from the start with the given parser mode.
+ * Returns the time taken in nanoseconds and leaves the graph for the caller to free.
+ */
+double timeParse(FILE *fp, int mapped) {
+
+	struct timespec start;
+
+	rewind(fp);
+	useMmap = mapped;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	parseMakeFileData(fp);
+	return elapsedNanos(&start);
+}
+
+
+/*
+ * main() -- Runs the parse benchmark for each size and prints one row per size and mode.
+ */
+int main() {
+
+	int sizes[] = {1000, 10000, 100000};
+	int index;
+
+	printf("%10s %8s %10s %12s %14s %8s\n", "targets", "mode", "MB", "parse (ms)", "ns / target", "chunks");
+
+	for (index = 0; index < (int)(sizeof(sizes) / sizeof(sizes[0])); index++) {
+		char name[] = "/tmp/benchParseXXXXXX";
+		int fd = mkstemp(name);
+		FILE *fp = fd < 0 ? NULL : fdopen(fd, "w+");
+
+		if (fp == NULL) {
+			perror("mkstemp");
+			return 1;
+		}
+		writeMakeFile(fp, sizes[index]);
+		fflush(fp);
+		double mb = ftell(fp) / 1e6;
+
+		int mode;
+		for (mode = 0; mode <= 2; mode++) {
+			double ns;
+
+			if (mode < 2) {
+				ns = timeParse(fp, mode);
+				if (mode == 1) {
+					saveGraphCache(name, fp);
+				}
+			} else {
+				struct timespec start;
+				clock_gettime(CLOCK_MONOTONIC, &start);
+				if (!loadGraphCache(name, fp)) {
+					fprintf(stderr, "Graph cache was not used.\n");
+				}
+				ns = elapsedNanos(&start);
+			}
+
+			printf("%10d %8s %10.1f %12.2f %14.1f %8ld\n", sizes[index],
+					mode == 0 ? "getline" : mode == 1 ? "mmap" : "cache",
+					mb, ns / 1e6, ns / sizes[index], arenaChunks);
+			freeLL();
+		}
+
+		char *slash = strrchr(name, '/');
+		char cacheName[64];
+		snprintf(cacheName, sizeof(cacheName), "/tmp/.%s.mymake_graph", slash + 1);
+		remove(cacheName);
+		remove(name);
+		fclose(fp);
+	}
+
+	int nameLens[] = {200, 4096, 65536};
+
+	printf("\n%10s %8s %8s %10s %12s\n", "name len", "mode", "targets", "MB", "parse (ms)");
+
+	for (index = 0; index < (int)(sizeof(nameLens) / sizeof(nameLens[0])); index++) {
+		FILE *fp = tmpfile();
+
+		if (fp == NULL) {
+			perror("tmpfile");
+			return 1;
+		}
+		int targets = 4 * 1024 * 1024 / nameLens[index];
+		writeLongMakeFile(fp, targets, nameLens[index], 8L * 1024 * 1024);
+		double mb = ftell(fp) / 1e6;
+
+		int mapped;
+		for (mapped = 0; mapped <= 1; mapped++) {
+			double ns = timeParse(fp, mapped);
+
+			printf("%10d %8s %8d %10.1f %12.2f\n", nameLens[index], mapped ? "mmap" : "getline",
+					targets, mb, ns / 1e6);
+			freeLL();
+		}
+		fclose(fp);
+	}
+
+	int ruleCounts[] = {1, 10, 100};
+
+	printf("\n%10s %10s %10s %12s %14s\n", "rules", "prereqs", "edges", "parse (ms)", "ns / prereq");
+
+	for (index = 0; index < (int)(sizeof(ruleCounts) / sizeof(ruleCounts[0])); index++) {
+		FILE *fp = tmpfile();
+
+		if (fp == NULL) {
+			perror("tmpfile");
+			return 1;
+		}
+		writeFanInMakeFile(fp, ruleCounts[index]);
+
+		long prereqs = (long)ruleCounts[index] * FANIN_PREREQS;
+		double ns = timeParse(fp, 1);
+
+		printf("%10d %10ld %10d %12.2f %14.1f\n", ruleCounts[index], prereqs, graph.edgeCount,
+				ns / 1e6, ns / prereqs);
+		freeLL();
+		fclose(fp);
+	}
+	return 0;
+}
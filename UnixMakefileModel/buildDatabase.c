@@ -0,0 +1,446 @@
+/*
+* File: buildDatabase.c
+* Author: Chance Krueger
+* Purpose: Defines the persistent build database (`.<name>.mymake_db`,
+* kept next to the makefile `name`). For every target it remembers a hash of the
+* recipe lines, a hash of the names and mtimes of its prerequisites,
+* and the output's own mtime, as seen at its last successful build,
+* along with how long that build's recipe took.
+* A target whose recipe and prerequisites are unchanged is up to date
+* even if mtimes say otherwise, and a changed recipe always rebuilds.
+* Records are appended at the end of each run; the file is rewritten
+* with only the live records once stale ones make up half of it.
+*/
+
+
+# include "header.h"
+# include <stdint.h>
+
+#define DB_MAGIC "MYMAKEDB2\n"
+#define DB_COMPACT_MIN 64
+
+/*
+ * struct diskRecord -- The fixed part of one record on disk. It is
+ * followed by `nameLen` bytes of target name.
+ */
+struct diskRecord {
+	uint64_t recipeHash;
+	uint64_t inputHash;
+	int64_t outputSec;
+	int64_t outputNsec;
+	int64_t duration;
+	uint32_t nameLen;
+};
+
+// GLOBAL VARIBLES
+char *buildDbPath = NULL;
+
+static long recordsOnDisk = 0;
+static int mustCompact = 0;
+static char *keptRecords = NULL;
+static size_t keptBytes = 0;
+static size_t keptSize = 0;
+static long keptCount = 0;
+
+
+/*
+ * setBuildDatabase(makeFileName) -- Places the build database of `makeFileName` in
+ * the same directory, named after it, so makefiles that share a directory and
+ * target names keep their records apart. Passing `NULL` turns the database off.
+ */
+void setBuildDatabase(char *makeFileName) {
+
+	free(buildDbPath);
+	buildDbPath = NULL;
+
+	if (makeFileName == NULL) {
+		return;
+	}
+
+	char *slash = strrchr(makeFileName, '/');
+	char *base = slash ? slash + 1 : makeFileName;
+	size_t dirLen = base - makeFileName;
+
+	buildDbPath = malloc(strlen(makeFileName) + strlen(DB_SUFFIX) + 2);
+	if (buildDbPath == NULL) {
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	memcpy(buildDbPath, makeFileName, dirLen);
+	sprintf(buildDbPath + dirLen, ".%s%s", base, DB_SUFFIX);
+}
+
+
+/*
+ * recipeHash(node) -- Hashes every command line of `node`, in order.
+ */
+unsigned long recipeHash(struct parentNode *node) {
+
+	unsigned long hash = hashName("", 0);
+	struct LineNode *cur;
+
+	for (cur = node->cmds; cur != NULL; cur = cur->next) {
+		hash = hashBytes(hash, cur->line, strlen(cur->line) + 1);
+	}
+	return hash;
+}
+
+
+/*
+ * inputHash(id) -- Hashes the name, existence and mtime of every prerequisite of node `id`.
+ * With `--hash`, the content hash of each prerequisite is used in place of its mtime, and
+ * so it is for a `.RESTAT` prerequisite always, whose mtime changes when its content does not.
+ */
+unsigned long inputHash(int id) {
+
+	unsigned long hash = hashName("", 0);
+	int edge;
+
+	for (edge = graph.childStart[id]; edge < graph.childStart[id + 1]; edge++) {
+		int childId = graph.childIds[edge];
+		struct parentNode *child = graph.nodes[childId];
+		int64_t stamp[3] = {graph.flags[childId].doesExist, graph.mtime[childId].tv_sec, graph.mtime[childId].tv_nsec};
+		unsigned long content;
+
+		if ((useHash || graph.flags[childId].restat) && contentHashOf(childId, &content)) {
+			stamp[1] = content;
+			stamp[2] = -1;
+		}
+
+		hash = hashBytes(hash, child->name, strlen(child->name) + 1);
+		hash = hashBytes(hash, stamp, sizeof(stamp));
+	}
+	return hash;
+}
+
+
+/*
+ * getRecord(node) -- Returns the record of `node`, allocating an empty one in the arena first if needed.
+ */
+struct buildRecord *getRecord(struct parentNode *node) {
+
+	if (node->record == NULL) {
+		node->record = arenaZalloc(sizeof(struct buildRecord));
+	}
+	return node->record;
+}
+
+
+/*
+ * keepRecord(disk, name) -- Keeps the record `disk` of the target `name` as it was on disk,
+ * so it is written back unchanged by `compactBuildDatabase`. Exits if memory allocation fails.
+ */
+static void keepRecord(struct diskRecord *disk, const char *name) {
+
+	size_t len = sizeof(*disk) + disk->nameLen;
+
+	if (keptBytes + len > keptSize) {
+		keptSize = keptSize ? keptSize * 2 : 4096;
+		while (keptSize < keptBytes + len) {
+			keptSize *= 2;
+		}
+		keptRecords = realloc(keptRecords, keptSize);
+
+		if (keptRecords == NULL) {
+			freeLL();
+			fprintf(stderr, "Ran Out of Memory.\n");
+			exit(1);
+		}
+	}
+	memcpy(keptRecords + keptBytes, disk, sizeof(*disk));
+	memcpy(keptRecords + keptBytes + sizeof(*disk), name, disk->nameLen);
+	keptBytes += len;
+	keptCount++;
+}
+
+
+/*
+ * loadBuildDatabase() -- Reads the build database and attaches each record to
+ * the node of the same name. Later records override earlier ones. Records of
+ * targets that are no longer in the makefile are dropped, unless the graph was
+ * parsed only for some goals; then records of targets it does not hold are kept
+ * as they are. A file that is unreadable, from another format or cut short is
+ * rewritten on the next save.
+ */
+void loadBuildDatabase() {
+
+	recordsOnDisk = 0;
+	mustCompact = 0;
+	keptBytes = 0;
+	keptCount = 0;
+
+	if (buildDbPath == NULL) {
+		return;
+	}
+
+	FILE *fp = fopen(buildDbPath, "rb");
+	if (fp == NULL) {
+		mustCompact = 1;
+		return;
+	}
+
+	char magic[sizeof(DB_MAGIC) - 1];
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, DB_MAGIC, sizeof(magic)) != 0) {
+		mustCompact = 1;
+		fclose(fp);
+		return;
+	}
+
+	struct diskRecord disk;
+	struct stat fileData;
+	char *name = NULL;
+	size_t nameSize = 0;
+	size_t got = 0;
+	off_t left = fstat(fileno(fp), &fileData) == 0 ? fileData.st_size - (off_t)sizeof(magic) : 0;
+
+	while ((got = fread(&disk, 1, sizeof(disk), fp)) == sizeof(disk)) {
+
+		// A name longer than the rest of the file means the record is garbage.
+		left -= sizeof(disk);
+		if (disk.nameLen == 0 || disk.nameLen > left) {
+			break;
+		}
+		left -= disk.nameLen;
+		if (disk.nameLen + 1 > nameSize) {
+			nameSize = disk.nameLen + 1;
+			name = realloc(name, nameSize);
+			if (name == NULL) {
+				freeLL();
+				fprintf(stderr, "Ran Out of Memory.\n");
+				exit(1);
+			}
+		}
+		if (fread(name, 1, disk.nameLen, fp) != disk.nameLen) {
+			got = 1;
+			break;
+		}
+		recordsOnDisk++;
+
+		struct parentNode *node = tableFind(name, disk.nameLen);
+		if (node == NULL && partialGraph) {
+			keepRecord(&disk, name);
+			continue;
+		}
+		if (node == NULL) {
+			continue;
+		}
+
+		struct buildRecord *record = getRecord(node);
+		record->recipeHash = disk.recipeHash;
+		record->inputHash = disk.inputHash;
+		record->output.tv_sec = disk.outputSec;
+		record->output.tv_nsec = disk.outputNsec;
+		record->duration = disk.duration;
+		record->dirty = 0;
+	}
+
+	// Anything but a clean end after a whole record, such as a record cut short,
+	// would have the next save append after garbage, so the file is rewritten.
+	if (got != 0 || ferror(fp)) {
+		mustCompact = 1;
+	}
+	free(name);
+	fclose(fp);
+}
+
+
+/*
+ * recordIsCurrent(id) -- Decides from the build database whether node `id` is up to date.
+ * Returns `1` if the recipe, prerequisites and output are exactly as they were at the
+ * last successful build, `0` if the recipe or the prerequisites changed, and `-1` if
+ * there is no record, only the output changed, or a phony prerequisite ran its recipe,
+ * in which case mtimes decide.
+ */
+int recordIsCurrent(int id) {
+
+	struct parentNode *node = graph.nodes[id];
+	struct buildRecord *record = node->record;
+	int edge;
+
+	if (record == NULL || !graph.flags[id].doesExist) {
+		return -1;
+	}
+	for (edge = graph.childStart[id]; edge < graph.childStart[id + 1]; edge++) {
+		struct nodeFlags child = graph.flags[graph.childIds[edge]];
+
+		if (child.phony && !child.doesExist) {
+			return -1;
+		}
+	}
+	if (record->recipeHash != recipeHash(node) || record->inputHash != inputHash(id)) {
+		return 0;
+	}
+	if (compareTime(record->output, graph.mtime[id]) != 0) {
+		return -1;
+	}
+	return 1;
+}
+
+
+/*
+ * recordBuild(id) -- Remembers the current recipe, prerequisites and output
+ * of node `id` after it finished successfully. Targets without a recipe or without
+ * an output file are not recorded. Marks the record to be saved if it changed.
+ */
+void recordBuild(int id) {
+
+	struct parentNode *node = graph.nodes[id];
+
+	if (buildDbPath == NULL || !graph.flags[id].target || node->cmds == NULL || !graph.flags[id].doesExist) {
+		return;
+	}
+
+	unsigned long recipe = recipeHash(node);
+	unsigned long inputs = inputHash(id);
+	struct buildRecord *record = node->record;
+
+	if (record != NULL && record->recipeHash == recipe && record->inputHash == inputs
+			&& compareTime(record->output, graph.mtime[id]) == 0) {
+		return;
+	}
+
+	record = getRecord(node);
+	record->recipeHash = recipe;
+	record->inputHash = inputs;
+	record->output = graph.mtime[id];
+	record->dirty = 1;
+}
+
+
+/*
+ * recordDuration(id, nanos) -- Remembers that the recipe of node `id`, just recorded
+ * by `recordBuild`, took `nanos` nanoseconds. Nodes without a record are skipped.
+ */
+void recordDuration(int id, double nanos) {
+
+	struct buildRecord *record = graph.nodes[id]->record;
+
+	if (buildDbPath == NULL || record == NULL) {
+		return;
+	}
+	record->duration = nanos;
+	record->dirty = 1;
+}
+
+
+/*
+ * writeRecord(fp, node) -- Writes the record of `node` to `fp`.
+ * Returns `1` on success and `0` on a write error.
+ */
+int writeRecord(FILE *fp, struct parentNode *node) {
+
+	struct diskRecord disk;
+	memset(&disk, 0, sizeof(disk));
+
+	disk.recipeHash = node->record->recipeHash;
+	disk.inputHash = node->record->inputHash;
+	disk.outputSec = node->record->output.tv_sec;
+	disk.outputNsec = node->record->output.tv_nsec;
+	disk.duration = node->record->duration;
+	disk.nameLen = strlen(node->name);
+
+	return fwrite(&disk, sizeof(disk), 1, fp) == 1
+		&& fwrite(node->name, 1, disk.nameLen, fp) == disk.nameLen;
+}
+
+
+/*
+ * compactBuildDatabase(live) -- Rewrites the database with one record per node
+ * that has one, followed by the records kept by `loadBuildDatabase`, into a
+ * temporary file that then replaces the old database.
+ */
+void compactBuildDatabase(long live) {
+
+	size_t len = strlen(buildDbPath);
+	char *tempPath = malloc(len + 5);
+
+	if (tempPath == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	memcpy(tempPath, buildDbPath, len);
+	strcpy(tempPath + len, ".tmp");
+
+	FILE *fp = fopen(tempPath, "wb");
+	if (fp == NULL) {
+		perror(tempPath);
+		free(tempPath);
+		return;
+	}
+
+	int ok = fwrite(DB_MAGIC, 1, strlen(DB_MAGIC), fp) == strlen(DB_MAGIC);
+	struct parentNode *cur;
+
+	for (cur = headLL; cur != NULL && ok; cur = cur->next) {
+		if (cur->record != NULL) {
+			ok = writeRecord(fp, cur);
+			cur->record->dirty = 0;
+		}
+	}
+	if (ok && keptBytes > 0) {
+		ok = fwrite(keptRecords, 1, keptBytes, fp) == keptBytes;
+	}
+
+	if (fclose(fp) != 0 || !ok || rename(tempPath, buildDbPath) != 0) {
+		perror(buildDbPath);
+		remove(tempPath);
+	} else {
+		recordsOnDisk = live + keptCount;
+		mustCompact = 0;
+	}
+	free(tempPath);
+}
+
+
+/*
+ * saveBuildDatabase() -- Appends the records that changed during this run.
+ * Compacts the file instead when it could not be appended to, or when at
+ * least half of the records on disk would be out of date. A graph parsed
+ * only for some goals does not hold every target, so it is never compacted
+ * for being out of date, and when it must be compacted, the records of the
+ * other targets are written back as they were read.
+ */
+void saveBuildDatabase() {
+
+	if (buildDbPath == NULL) {
+		return;
+	}
+
+	long live = 0;
+	long dirty = 0;
+	struct parentNode *cur;
+
+	for (cur = headLL; cur != NULL; cur = cur->next) {
+		if (cur->record != NULL) {
+			live++;
+			dirty += cur->record->dirty;
+		}
+	}
+
+	if (mustCompact || (!partialGraph && recordsOnDisk + dirty >= DB_COMPACT_MIN && recordsOnDisk + dirty > 2 * live)) {
+		compactBuildDatabase(live);
+		return;
+	}
+	if (dirty == 0) {
+		return;
+	}
+
+	FILE *fp = fopen(buildDbPath, "ab");
+	if (fp == NULL) {
+		perror(buildDbPath);
+		return;
+	}
+
+	int ok = 1;
+	for (cur = headLL; cur != NULL && ok; cur = cur->next) {
+		if (cur->record != NULL && cur->record->dirty) {
+			ok = writeRecord(fp, cur);
+			cur->record->dirty = 0;
+			recordsOnDisk++;
+		}
+	}
+	if (fclose(fp) != 0 || !ok) {
+		perror(buildDbPath);
+	}
+}
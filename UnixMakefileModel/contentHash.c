@@ -0,0 +1,422 @@
+/*
+* File: contentHash.c
+* Author: Chance Krueger
+* Purpose: Defines the content-hash mode behind `--hash`. In this
+* mode the build database hashes what is in each prerequisite rather
+* than its mtime, so touching a file or switching branches without
+* changing its contents does not rebuild anything. Hashes are
+* computed by a pool of threads right after the traversal and are
+* kept in `.<name>.mymake_hashes` next to the build database, keyed by the
+* file's inode, size and mtime, so an unchanged file is read once.
+*/
+
+
+# include "header.h"
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+
+#define HASH_SUFFIX ".mymake_hashes"
+#define HASH_MAGIC "MYMAKEHASH1\n"
+#define HASH_THREADS 8
+
+/*
+ * struct diskHash -- The fixed part of one record of the hash cache on disk.
+ * It is followed by `nameLen` bytes of file name.
+ */
+struct diskHash {
+	uint64_t ino;
+	int64_t size;
+	int64_t sec;
+	int64_t nsec;
+	uint64_t hash;
+	uint32_t nameLen;
+};
+
+// GLOBAL VARIBLES
+int useHash = 0;
+
+static char *hashPath = NULL;
+static struct parentNode **hashQueue = NULL;
+static long hashCount = 0;
+static long hashNext = 0;
+static long hashesComputed = 0;
+static long hashesReused = 0;
+static int hashesChanged = 0;
+static char *keptRecords = NULL;
+static size_t keptBytes = 0;
+static size_t keptSize = 0;
+
+
+/*
+ * keyMatches(node) -- Returns `1` if the hash stored for `node` was computed from
+ * the file as it is now: same inode, size and mtime.
+ */
+static int keyMatches(struct parentNode *node) {
+
+	struct contentRecord *content = node->content;
+
+	return content != NULL && content->valid && content->ino == node->fileIno
+		&& content->size == node->fileSize && compareTime(content->mtime, graph.mtime[node->id]) == 0;
+}
+
+
+/*
+ * hashFile(node) -- Reads the file of `node` and stores its content hash and the
+ * key it was computed for in `node->content`, which must already be allocated.
+ * The size mapped and the key come from the open file, not the earlier stat, since
+ * mapping past the end of a file that shrank in between would raise SIGBUS.
+ * Leaves the record invalid if the file cannot be read. Safe to run on several
+ * nodes at once from different threads.
+ */
+static void hashFile(struct parentNode *node) {
+
+	struct contentRecord *content = node->content;
+	struct stat fileData;
+	int fd = open(node->name, O_RDONLY);
+
+	content->valid = 0;
+	if (fd < 0) {
+		return;
+	}
+	if (fstat(fd, &fileData) != 0 || !S_ISREG(fileData.st_mode)) {
+		close(fd);
+		return;
+	}
+
+	if (fileData.st_size == 0) {
+		content->hash = hashContent("", 0);
+	} else {
+		void *data = mmap(NULL, fileData.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+		if (data == MAP_FAILED) {
+			close(fd);
+			return;
+		}
+		content->hash = hashContent(data, fileData.st_size);
+		munmap(data, fileData.st_size);
+	}
+	close(fd);
+
+	content->ino = fileData.st_ino;
+	content->size = fileData.st_size;
+	content->mtime = fileData.st_mtim;
+	content->valid = 1;
+}
+
+
+/*
+ * getContent(node) -- Returns the content record of `node`, allocating an empty one in the arena first if needed.
+ */
+static struct contentRecord *getContent(struct parentNode *node) {
+
+	if (node->content == NULL) {
+		node->content = arenaZalloc(sizeof(struct contentRecord));
+	}
+	return node->content;
+}
+
+
+/*
+ * contentHashOf(id, hash) -- Stores the content hash of the existing file of node `id`
+ * in `hash`, reading the file only if the cached hash is out of date. Returns `1` on
+ * success, or `0` if the file cannot be hashed and its mtime has to be used instead.
+ */
+int contentHashOf(int id, unsigned long *hash) {
+
+	struct parentNode *node = graph.nodes[id];
+
+	if (!graph.flags[id].doesExist) {
+		return 0;
+	}
+
+	if (keyMatches(node)) {
+		*hash = node->content->hash;
+		return 1;
+	}
+
+	getContent(node);
+	hashFile(node);
+	hashesComputed++;
+	hashesChanged = 1;
+
+	if (!node->content->valid) {
+		return 0;
+	}
+	*hash = node->content->hash;
+	return 1;
+}
+
+
+/*
+ * hashWorker(unused) -- Body of each thread of the pool. Takes the next node off
+ * the shared queue and hashes it until the queue is empty.
+ */
+static void *hashWorker(void *unused) {
+
+	long index;
+
+	(void)unused;
+
+	while ((index = __atomic_fetch_add(&hashNext, 1, __ATOMIC_RELAXED)) < hashCount) {
+		hashFile(hashQueue[index]);
+	}
+	return NULL;
+}
+
+
+/*
+ * hashInputs() -- Brings the content hash of every existing prerequisite found by
+ * `POT` up to date, using up to `HASH_THREADS` threads (no more than there are
+ * processors). Files whose inode, size and mtime match the cached hash are skipped.
+ */
+void hashInputs() {
+
+	if (!useHash || buildDbPath == NULL) {
+		return;
+	}
+
+	struct parentNode *cur;
+	hashCount = 0;
+
+	for (cur = headLL; cur != NULL; cur = cur->next) {
+		struct nodeFlags flags = graph.flags[cur->id];
+
+		if (!flags.visited || graph.parentStart[cur->id] == graph.parentStart[cur->id + 1] || !flags.doesExist) {
+			continue;
+		}
+		if (keyMatches(cur)) {
+			hashesReused++;
+			continue;
+		}
+
+		hashQueue = realloc(hashQueue, (hashCount + 1) * sizeof(struct parentNode *));
+		if (hashQueue == NULL) {
+			freeLL();
+			fprintf(stderr, "Ran Out of Memory.\n");
+			exit(1);
+		}
+		// The arena is not thread safe, so records are allocated up front.
+		getContent(cur);
+		hashQueue[hashCount++] = cur;
+	}
+
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads > HASH_THREADS) {
+		threads = HASH_THREADS;
+	}
+	if (threads > hashCount) {
+		threads = hashCount;
+	}
+
+	hashNext = 0;
+	runPool(hashWorker, threads);
+
+	hashesComputed += hashCount;
+	hashesChanged |= hashCount > 0;
+	free(hashQueue);
+	hashQueue = NULL;
+	hashCount = 0;
+}
+
+
+/*
+ * keepRecord(disk, name) -- Keeps the record `disk` of the file `name` as it was on disk,
+ * so it is written back unchanged by `saveHashCache`. Exits if memory allocation fails.
+ */
+static void keepRecord(struct diskHash *disk, const char *name) {
+
+	size_t len = sizeof(*disk) + disk->nameLen;
+
+	if (keptBytes + len > keptSize) {
+		keptSize = keptSize ? keptSize * 2 : 4096;
+		while (keptSize < keptBytes + len) {
+			keptSize *= 2;
+		}
+		keptRecords = realloc(keptRecords, keptSize);
+
+		if (keptRecords == NULL) {
+			freeLL();
+			fprintf(stderr, "Ran Out of Memory.\n");
+			exit(1);
+		}
+	}
+	memcpy(keptRecords + keptBytes, disk, sizeof(*disk));
+	memcpy(keptRecords + keptBytes + sizeof(*disk), name, disk->nameLen);
+	keptBytes += len;
+}
+
+
+/*
+ * loadHashCache() -- Reads the hash cache next to the build database and attaches
+ * each hash to the node of the same name. Files no longer in the makefile are dropped,
+ * unless the graph was parsed only for some goals; then files it does not hold are
+ * kept as they are.
+ */
+void loadHashCache() {
+
+	hashesComputed = 0;
+	hashesReused = 0;
+	hashesChanged = 0;
+	keptBytes = 0;
+	free(hashPath);
+	hashPath = NULL;
+
+	if ((!useHash && actionCacheDir == NULL) || buildDbPath == NULL) {
+		return;
+	}
+
+	size_t stemLen = strlen(buildDbPath) - strlen(DB_SUFFIX);
+
+	hashPath = malloc(stemLen + strlen(HASH_SUFFIX) + 1);
+	if (hashPath == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	memcpy(hashPath, buildDbPath, stemLen);
+	strcpy(hashPath + stemLen, HASH_SUFFIX);
+
+	FILE *fp = fopen(hashPath, "rb");
+	if (fp == NULL) {
+		return;
+	}
+
+	char magic[sizeof(HASH_MAGIC) - 1];
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) || memcmp(magic, HASH_MAGIC, sizeof(magic)) != 0) {
+		hashesChanged = 1;
+		fclose(fp);
+		return;
+	}
+
+	struct diskHash disk;
+	struct stat fileData;
+	char *name = NULL;
+	size_t nameSize = 0;
+	size_t got = 0;
+	off_t left = fstat(fileno(fp), &fileData) == 0 ? fileData.st_size - (off_t)sizeof(magic) : 0;
+
+	while ((got = fread(&disk, 1, sizeof(disk), fp)) == sizeof(disk)) {
+
+		// A name longer than the rest of the file means the record is garbage.
+		left -= sizeof(disk);
+		if (disk.nameLen == 0 || disk.nameLen > left) {
+			break;
+		}
+		left -= disk.nameLen;
+		if (disk.nameLen + 1 > nameSize) {
+			nameSize = disk.nameLen + 1;
+			name = realloc(name, nameSize);
+			if (name == NULL) {
+				freeLL();
+				fprintf(stderr, "Ran Out of Memory.\n");
+				exit(1);
+			}
+		}
+		if (fread(name, 1, disk.nameLen, fp) != disk.nameLen) {
+			got = 1;
+			break;
+		}
+
+		struct parentNode *node = tableFind(name, disk.nameLen);
+		if (node == NULL && partialGraph) {
+			keepRecord(&disk, name);
+			continue;
+		}
+		if (node == NULL) {
+			hashesChanged = 1;
+			continue;
+		}
+
+		struct contentRecord *content = getContent(node);
+		content->ino = disk.ino;
+		content->size = disk.size;
+		content->mtime.tv_sec = disk.sec;
+		content->mtime.tv_nsec = disk.nsec;
+		content->hash = disk.hash;
+		content->valid = 1;
+	}
+
+	// A cache cut short or holding garbage is rewritten with what could be read.
+	if (got != 0 || ferror(fp)) {
+		hashesChanged = 1;
+	}
+	free(name);
+	fclose(fp);
+}
+
+
+/*
+ * saveHashCache() -- Rewrites the hash cache with every valid hash in the graph and
+ * the records kept by `loadHashCache`, through a temporary file, if any hash was
+ * computed during this run.
+ */
+void saveHashCache() {
+
+	if (hashPath == NULL || !hashesChanged) {
+		return;
+	}
+
+	size_t len = strlen(hashPath);
+	char *tempPath = malloc(len + 5);
+
+	if (tempPath == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	memcpy(tempPath, hashPath, len);
+	strcpy(tempPath + len, ".tmp");
+
+	FILE *fp = fopen(tempPath, "wb");
+	if (fp == NULL) {
+		perror(tempPath);
+		free(tempPath);
+		return;
+	}
+
+	int ok = fwrite(HASH_MAGIC, 1, strlen(HASH_MAGIC), fp) == strlen(HASH_MAGIC);
+	struct parentNode *cur;
+
+	for (cur = headLL; cur != NULL && ok; cur = cur->next) {
+		if (cur->content == NULL || !cur->content->valid) {
+			continue;
+		}
+
+		struct diskHash disk;
+		memset(&disk, 0, sizeof(disk));
+		disk.ino = cur->content->ino;
+		disk.size = cur->content->size;
+		disk.sec = cur->content->mtime.tv_sec;
+		disk.nsec = cur->content->mtime.tv_nsec;
+		disk.hash = cur->content->hash;
+		disk.nameLen = strlen(cur->name);
+
+		ok = fwrite(&disk, sizeof(disk), 1, fp) == 1
+			&& fwrite(cur->name, 1, disk.nameLen, fp) == disk.nameLen;
+	}
+	if (ok && keptBytes > 0) {
+		ok = fwrite(keptRecords, 1, keptBytes, fp) == keptBytes;
+	}
+
+	if (fclose(fp) != 0 || !ok || rename(tempPath, hashPath) != 0) {
+		perror(hashPath);
+		remove(tempPath);
+	}
+	free(tempPath);
+	hashesChanged = 0;
+}
+
+
+/*
+ * printHashStats() -- Prints how many files were hashed and how many hashes were
+ * reused from the cache, if `--stat-stats` was given and hashes were used (`--hash`
+ * or the action cache).
+ */
+void printHashStats() {
+
+	if (!statStats || hashPath == NULL) {
+		return;
+	}
+	fprintf(stderr, "content hashes computed %ld, reused %ld\n", hashesComputed, hashesReused);
+}
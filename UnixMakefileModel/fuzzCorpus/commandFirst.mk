@@ -0,0 +1,2 @@
+	echo first
+x : y
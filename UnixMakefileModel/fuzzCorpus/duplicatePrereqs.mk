@@ -0,0 +1,6 @@
+all : a a b a
+	
+	   
+	echo "$@" > out ; cat out
+a : 
+b :
@@ -0,0 +1,2 @@
+x : y
+x : z
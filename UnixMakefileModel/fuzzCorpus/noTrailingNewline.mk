@@ -0,0 +1,8 @@
+a:b c
+	echo a
+b :c
+	echo b
+
+   
+c:
+	touch c
\ No newline at end of file
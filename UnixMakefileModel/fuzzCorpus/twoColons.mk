@@ -0,0 +1 @@
+x : y : z
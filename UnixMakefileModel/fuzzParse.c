@@ -0,0 +1,273 @@
+/*
+* File: fuzzParse.c
+* Author: Chance Krueger
+* Purpose: Mutation fuzzer for the makefile parsers. Loads every file
+* in a corpus directory (see fuzzCorpus/), mutates them with byte
+* flips, deletions, copies, makefile punctuation and long runs that
+* make names and lines many megabytes long, and parses each result
+* in a child process with both the memory-mapped and the `getline`
+* parser. A child that exits normally (parsed, or rejected with a
+* format error) is fine; a child killed by a signal is a crash and
+* its input is saved as crash-N.mk. Build it with -fsanitize=address
+* so memory errors are caught as crashes.
+*/
+
+
+# include "header.h"
+# include <dirent.h>
+# include <unistd.h>
+# include <fcntl.h>
+# include <sys/wait.h>
+
+#define MAX_RUN (4 * 1024 * 1024)
+
+/*
+ * struct buffer -- A growable byte buffer holding one input.
+ */
+struct buffer {
+	char *data;
+	size_t len;
+	size_t size;
+};
+
+static struct buffer *corpus = NULL;
+static int corpusCount = 0;
+
+
+/*
+ * __asan_default_options() -- Turns off leak checking when built with
+ * -fsanitize=address. Children that reject an input exit without freeing
+ * the copy of the corpus they inherited, which is not a parser bug.
+ */
+const char *__asan_default_options() {
+
+	return "detect_leaks=0";
+}
+
+
+/*
+ * reserve(buf, extra) -- Makes room for `extra` more bytes in `buf`.
+ */
+void reserve(struct buffer *buf, size_t extra) {
+
+	if (buf->len + extra <= buf->size) {
+		return;
+	}
+	buf->size = (buf->len + extra) * 2;
+	buf->data = realloc(buf->data, buf->size);
+
+	if (buf->data == NULL) {
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+}
+
+
+/*
+ * loadCorpus(dirName) -- Reads every regular file in `dirName` into `corpus`.
+ * Returns the number of files read.
+ */
+int loadCorpus(char *dirName) {
+
+	DIR *dir = opendir(dirName);
+
+	if (dir == NULL) {
+		perror(dirName);
+		exit(1);
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(dir)) != NULL) {
+		char path[4096];
+		snprintf(path, sizeof(path), "%s/%s", dirName, entry->d_name);
+
+		struct stat fileData;
+		if (stat(path, &fileData) != 0 || !S_ISREG(fileData.st_mode)) {
+			continue;
+		}
+
+		FILE *fp = fopen(path, "rb");
+		if (fp == NULL) {
+			continue;
+		}
+
+		corpus = realloc(corpus, (corpusCount + 1) * sizeof(struct buffer));
+		struct buffer *buf = &corpus[corpusCount++];
+		memset(buf, 0, sizeof(*buf));
+		reserve(buf, fileData.st_size + 1);
+		buf->len = fread(buf->data, 1, fileData.st_size, fp);
+		fclose(fp);
+	}
+	closedir(dir);
+	return corpusCount;
+}
+
+
+/*
+ * mutate(buf) -- Applies one random mutation to `buf`.
+ */
+void mutate(struct buffer *buf) {
+
+	static const char special[] = ":\t\n #\\$";
+	size_t pos = buf->len ? (size_t)rand() % (buf->len + 1) : 0;
+
+	switch (rand() % 6) {
+
+	case 0: // flip a byte
+		if (buf->len > 0) {
+			buf->data[pos % buf->len] ^= 1 << (rand() % 8);
+		}
+		break;
+
+	case 1: // insert makefile punctuation
+		reserve(buf, 1);
+		memmove(buf->data + pos + 1, buf->data + pos, buf->len - pos);
+		buf->data[pos] = special[rand() % (sizeof(special) - 1)];
+		buf->len++;
+		break;
+
+	case 2: { // delete a range
+		size_t count = buf->len > pos ? (size_t)rand() % (buf->len - pos + 1) : 0;
+		memmove(buf->data + pos, buf->data + pos + count, buf->len - pos - count);
+		buf->len -= count;
+		break;
+	}
+
+	case 3: { // copy a range of the input somewhere else
+		if (buf->len == 0) {
+			break;
+		}
+		size_t from = rand() % buf->len;
+		size_t count = rand() % (buf->len - from) + 1;
+		char *copy = malloc(count);
+
+		if (copy == NULL) {
+			fprintf(stderr, "Ran Out of Memory.\n");
+			exit(1);
+		}
+		memcpy(copy, buf->data + from, count);
+		reserve(buf, count);
+		memmove(buf->data + pos + count, buf->data + pos, buf->len - pos);
+		memcpy(buf->data + pos, copy, count);
+		buf->len += count;
+		free(copy);
+		break;
+	}
+
+	default: { // insert a long run, making a very long name or line
+		size_t count = (size_t)1 << (rand() % 23);
+		if (count > MAX_RUN) {
+			count = MAX_RUN;
+		}
+		reserve(buf, count);
+		memmove(buf->data + pos + count, buf->data + pos, buf->len - pos);
+		memset(buf->data + pos, rand() % 2 ? 'a' + rand() % 26 : ' ', count);
+		buf->len += count;
+		break;
+	}
+	}
+}
+
+
+/*
+ * runParser(buf, mapped) -- Parses `buf` in a child process with the given parser.
+ * Returns the child's exit code, or `-1` if it was killed by a signal.
+ */
+int runParser(struct buffer *buf, int mapped) {
+
+	FILE *fp = tmpfile();
+
+	if (fp == NULL || fwrite(buf->data, 1, buf->len, fp) != buf->len || fflush(fp) != 0) {
+		perror("tmpfile");
+		exit(1);
+	}
+	rewind(fp);
+
+	pid_t pid = fork();
+	if (pid < 0) {
+		perror("fork");
+		exit(1);
+	} else if (pid == 0) {
+		int devNull = open("/dev/null", O_WRONLY);
+		dup2(devNull, 2);
+		useMmap = mapped;
+		parseMakeFileData(fp);
+		freeLL();
+		_exit(0);
+	}
+
+	int status;
+	waitpid(pid, &status, 0);
+	fclose(fp);
+
+	if (WIFSIGNALED(status)) {
+		return -1;
+	}
+	return WEXITSTATUS(status);
+}
+
+
+/*
+ * main(argc, argv) -- Usage: fuzzParse corpusDir [iterations] [seed]
+ * Prints how many inputs parsed, were rejected and crashed.
+ */
+int main(int argc, char *argv[]) {
+
+	if (argc < 2) {
+		fprintf(stderr, "Usage: %s corpusDir [iterations] [seed]\n", argv[0]);
+		return 1;
+	}
+
+	int iterations = argc > 2 ? atoi(argv[2]) : 1000;
+	srand(argc > 3 ? atoi(argv[3]) : 1);
+
+	if (loadCorpus(argv[1]) == 0) {
+		fprintf(stderr, "Corpus %s is empty.\n", argv[1]);
+		return 1;
+	}
+
+	long parsed = 0, rejected = 0, crashed = 0;
+	struct buffer input = {NULL, 0, 0};
+	int iteration;
+
+	for (iteration = 0; iteration < iterations; iteration++) {
+		struct buffer *seed = &corpus[rand() % corpusCount];
+
+		input.len = 0;
+		reserve(&input, seed->len);
+		memcpy(input.data, seed->data, seed->len);
+		input.len = seed->len;
+
+		int mutations = rand() % 4 + 1;
+		while (mutations-- > 0) {
+			mutate(&input);
+		}
+
+		int result = runParser(&input, iteration % 2);
+		if (result == 0) {
+			parsed++;
+		} else if (result > 0) {
+			rejected++;
+		} else {
+			char name[64];
+			snprintf(name, sizeof(name), "crash-%d.mk", iteration);
+
+			FILE *out = fopen(name, "wb");
+			if (out != NULL) {
+				fwrite(input.data, 1, input.len, out);
+				fclose(out);
+			}
+			fprintf(stderr, "Crash on iteration %d, input saved to %s\n", iteration, name);
+			crashed++;
+		}
+	}
+
+	printf("%d inputs: %ld parsed, %ld rejected, %ld crashed\n", iterations, parsed, rejected, crashed);
+
+	free(input.data);
+	while (corpusCount > 0) {
+		free(corpus[--corpusCount].data);
+	}
+	free(corpus);
+	return crashed > 0;
+}
@@ -0,0 +1,273 @@
+/*
+* File: graph.c
+* Author: Chance Krueger
+* Purpose: Defines the compact form of the dependency graph. Every
+* node has a dense id, and what the traversal and the scheduler read
+* for every node (flags, mtime, pending count, order) is kept in
+* arrays indexed by that id rather than in the `parentNode`. Edges
+* are stored in CSR form: one array of prerequisite ids grouped by
+* node, one array of offsets into it, and the same pair for the
+* reverse edges. While a makefile is parsed, each rule appends its
+* prerequisites in one run, rejecting duplicates in constant time
+* with a mark per node; `freezeGraph` then lays them out by id and
+* builds the reverse edges.
+*/
+
+
+# include "header.h"
+
+#define GRAPH_START_SIZE 1024
+
+// GLOBAL VARIBLES
+struct graph graph;
+
+static int nodeCapacity = 0;
+static int edgeCapacity = 0;
+static int *edgeParent = NULL;
+static int *edgeMark = NULL;
+
+
+/*
+ * growArray(array, count, size) -- Resizes `*array` to `count` elements of `size` bytes.
+ * Exits if memory allocation fails.
+ */
+static void growArray(void *array, size_t count, size_t size) {
+
+	void **slot = array;
+	void *grown = realloc(*slot, count * size);
+
+	if (grown == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	*slot = grown;
+}
+
+
+/*
+ * graphReserve(nodeCount, edgeCount) -- Makes room for at least `nodeCount` nodes and
+ * `edgeCount` edges without further resizing.
+ */
+void graphReserve(int nodeCount, int edgeCount) {
+
+	if (nodeCount > nodeCapacity) {
+		nodeCapacity = nodeCount;
+		growArray(&graph.nodes, nodeCapacity, sizeof(struct parentNode *));
+		growArray(&graph.flags, nodeCapacity, sizeof(struct nodeFlags));
+		growArray(&graph.mtime, nodeCapacity, sizeof(struct timespec));
+		growArray(&graph.pending, nodeCapacity, sizeof(int));
+		growArray(&graph.order, nodeCapacity, sizeof(int));
+		growArray(&graph.childStart, nodeCapacity + 1, sizeof(int));
+		if (!graph.frozen) {
+			growArray(&edgeMark, nodeCapacity, sizeof(int));
+		}
+	}
+	if (edgeCount > edgeCapacity) {
+		edgeCapacity = edgeCount;
+		growArray(&graph.childIds, edgeCapacity, sizeof(int));
+		if (!graph.frozen) {
+			growArray(&edgeParent, edgeCapacity, sizeof(int));
+		}
+	}
+}
+
+
+/*
+ * graphAddNode(node) -- Gives the node with id `node->id`, which must be the next id,
+ * its slot in the graph arrays. The node starts with no flags and no prerequisites.
+ */
+void graphAddNode(struct parentNode *node) {
+
+	int id = node->id;
+
+	if (id >= nodeCapacity) {
+		graphReserve(nodeCapacity ? nodeCapacity * 2 : GRAPH_START_SIZE, 0);
+	}
+
+	graph.nodes[id] = node;
+	memset(&graph.flags[id], 0, sizeof(struct nodeFlags));
+	graph.mtime[id].tv_sec = 0;
+	graph.mtime[id].tv_nsec = 0;
+	graph.pending[id] = 0;
+	graph.order[id] = 0;
+	graph.childStart[id] = 0;
+	if (!graph.frozen) {
+		edgeMark[id] = -1;
+	}
+}
+
+
+/*
+ * graphAddEdge(parent, child) -- Adds `child` as a prerequisite of `parent` while a makefile
+ * is parsed. All prerequisites of a node come from one rule, so they are appended in one
+ * run at the end of the edge array and `childStart[parent]` counts them until the graph is
+ * frozen. Prevents duplicate children: `edgeMark[child]` holds the last parent that took
+ * `child`, and only one rule per parent has prerequisites, so a duplicate is found without
+ * scanning the rule and costs no allocation.
+ */
+void graphAddEdge(int parent, int child) {
+
+	if (edgeMark[child] == parent) {
+		return;
+	}
+	edgeMark[child] = parent;
+
+	if (graph.edgeCount == edgeCapacity) {
+		graphReserve(0, edgeCapacity ? edgeCapacity * 2 : GRAPH_START_SIZE);
+	}
+	graph.childIds[graph.edgeCount] = child;
+	edgeParent[graph.edgeCount] = parent;
+	graph.edgeCount++;
+	graph.childStart[parent]++;
+}
+
+
+/*
+ * graphChildCount(id) -- Returns how many prerequisites node `id` has.
+ */
+int graphChildCount(int id) {
+
+	if (!graph.frozen) {
+		return graph.childStart[id];
+	}
+	return graph.childStart[id + 1] - graph.childStart[id];
+}
+
+
+/*
+ * buildDependents() -- Builds the reverse edges from the frozen prerequisite arrays. The
+ * dependents of each node are listed in id order, each with the index of the edge it mirrors.
+ */
+static void buildDependents() {
+
+	int id;
+	int edge;
+
+	graph.parentStart = calloc(graphSize + 1, sizeof(int));
+	graph.parentIds = malloc((graph.edgeCount ? graph.edgeCount : 1) * sizeof(int));
+	graph.parentEdge = malloc((graph.edgeCount ? graph.edgeCount : 1) * sizeof(int));
+	graph.dropped = calloc(graph.edgeCount ? graph.edgeCount : 1, 1);
+
+	if (graph.parentStart == NULL || graph.parentIds == NULL || graph.parentEdge == NULL || graph.dropped == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+
+	for (edge = 0; edge < graph.edgeCount; edge++) {
+		graph.parentStart[graph.childIds[edge] + 1]++;
+	}
+	for (id = 0; id < graphSize; id++) {
+		graph.parentStart[id + 1] += graph.parentStart[id];
+	}
+
+	// parentStart[child] is used as the fill position, then shifted back.
+	for (id = 0; id < graphSize; id++) {
+		for (edge = graph.childStart[id]; edge < graph.childStart[id + 1]; edge++) {
+			int at = graph.parentStart[graph.childIds[edge]]++;
+
+			graph.parentIds[at] = id;
+			graph.parentEdge[at] = edge;
+		}
+	}
+	for (id = graphSize; id > 0; id--) {
+		graph.parentStart[id] = graph.parentStart[id - 1];
+	}
+	graph.parentStart[0] = 0;
+}
+
+
+/*
+ * freezeGraph() -- Finishes the graph once every node and edge is in. Sorts the edges
+ * appended by `graphAddEdge` by parent id, keeping makefile order within each node, so
+ * that the prerequisites of `id` lie between `childStart[id]` and `childStart[id + 1]`,
+ * then builds the reverse edges. A graph loaded already laid out (`frozen` set) only
+ * gets its reverse edges.
+ */
+void freezeGraph() {
+
+	int id;
+	int edge;
+
+	if (graphSize == 0) {
+		graphReserve(1, 0);
+	}
+
+	if (!graph.frozen) {
+		int *sorted = malloc((graph.edgeCount ? graph.edgeCount : 1) * sizeof(int));
+
+		if (sorted == NULL) {
+			freeLL();
+			fprintf(stderr, "Ran Out of Memory.\n");
+			exit(1);
+		}
+
+		// Counts become start offsets, used as fill positions, then shifted back.
+		int start = 0;
+		for (id = 0; id < graphSize; id++) {
+			int count = graph.childStart[id];
+
+			graph.childStart[id] = start;
+			start += count;
+		}
+		for (edge = 0; edge < graph.edgeCount; edge++) {
+			sorted[graph.childStart[edgeParent[edge]]++] = graph.childIds[edge];
+		}
+		for (id = graphSize; id > 0; id--) {
+			graph.childStart[id] = graph.childStart[id - 1];
+		}
+		graph.childStart[0] = 0;
+
+		free(graph.childIds);
+		free(edgeParent);
+		free(edgeMark);
+		graph.childIds = sorted;
+		edgeParent = NULL;
+		edgeMark = NULL;
+		edgeCapacity = graph.edgeCount;
+		graph.frozen = 1;
+	}
+	graph.childStart[graphSize] = graph.edgeCount;
+	buildDependents();
+}
+
+
+/*
+ * graphBytes() -- Returns how many bytes the nodes and the graph arrays take, not
+ * counting names and recipe lines.
+ */
+size_t graphBytes() {
+
+	size_t perNode = sizeof(struct parentNode *) + sizeof(struct nodeFlags) + sizeof(struct timespec) + 3 * sizeof(int);
+	size_t perEdge = graph.frozen ? 3 * sizeof(int) + 1 : 2 * sizeof(int);
+
+	return (size_t)graphSize * sizeof(struct parentNode) + (size_t)nodeCapacity * perNode + sizeof(int)
+		+ (graph.parentStart ? (size_t)(graphSize + 1) * sizeof(int) : 0) + (size_t)edgeCapacity * perEdge;
+}
+
+
+/*
+ * freeGraph() -- Frees every array of the graph and empties it. Called by `freeLL()`.
+ */
+void freeGraph() {
+
+	free(graph.nodes);
+	free(graph.flags);
+	free(graph.mtime);
+	free(graph.pending);
+	free(graph.order);
+	free(graph.childStart);
+	free(graph.childIds);
+	free(graph.parentStart);
+	free(graph.parentIds);
+	free(graph.parentEdge);
+	free(graph.dropped);
+	free(edgeParent);
+	free(edgeMark);
+	memset(&graph, 0, sizeof(graph));
+	edgeParent = NULL;
+	edgeMark = NULL;
+	nodeCapacity = 0;
+	edgeCapacity = 0;
+}
@@ -0,0 +1,493 @@
+/*
+* File: graphCache.c
+* Author: Chance Krueger
+* Purpose: Defines the compiled-graph cache. After a makefile is
+* parsed, its graph is written next to it as a compact binary file:
+* a node table, CSR arrays of prerequisite ids and recipe line
+* offsets, and one blob of null-terminated names and lines, all
+* addressed by offset so the file can be mapped anywhere. The file
+* is keyed by the makefile's size, mtime and content hash. On a
+* later run with an unchanged makefile the cache is memory-mapped,
+* names and lines are used in place, and no parsing is done.
+*/
+
+
+# include "header.h"
+# include <stdint.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+
+#define GRAPH_MAGIC "MMGRAPH3"
+#define GRAPH_TARGET 1
+#define GRAPH_PHONY 2
+#define GRAPH_RESTAT 4
+#define GRAPH_NO_GOAL UINT32_MAX
+
+/*
+ * struct graphHeader -- The start of a cache file. Stores the key of the
+ * makefile it was built from, the node of the default goal and the size
+ * of each section. The node
+ * table, the edge array, the line array and the string blob follow in
+ * that order, each starting on an 8-byte boundary.
+ */
+struct graphHeader {
+	char magic[8];
+	uint64_t makeSize;
+	int64_t makeSec;
+	int64_t makeNsec;
+	uint64_t makeHash;
+	uint32_t nodeCount;
+	uint32_t edgeCount;
+	uint32_t lineCount;
+	uint32_t defaultGoal;
+	uint64_t stringSize;
+};
+
+/*
+ * struct graphNode -- One node of the cache. Stores the hash of its name,
+ * the offset of the name in the string blob, whether it is a target, phony
+ * or restat (`flags`), and
+ * where its prerequisites and recipe lines start in the edge and line
+ * arrays and how many there are.
+ */
+struct graphNode {
+	uint64_t nameHash;
+	uint32_t nameOffset;
+	uint32_t flags;
+	uint32_t firstEdge;
+	uint32_t edgeCount;
+	uint32_t firstLine;
+	uint32_t lineCount;
+};
+
+// GLOBAL VARIBLES
+int useGraphCache = 1;
+
+static void *cacheData = NULL;
+static size_t cacheSize = 0;
+
+
+/*
+ * align8(size) -- Rounds `size` up to a multiple of 8.
+ */
+static size_t align8(size_t size) {
+
+	return (size + 7) & ~(size_t)7;
+}
+
+
+/*
+ * hashContent(data, len) -- Hashes `len` bytes of `data` eight bytes at a time.
+ * Much faster than byte-wise FNV on large inputs such as whole makefiles.
+ */
+uint64_t hashContent(const void *data, size_t len) {
+
+	const unsigned char *bytes = data;
+	uint64_t hash = 0x9E3779B97F4A7C15ULL ^ (len * 0xC2B2AE3D27D4EB4FULL);
+	uint64_t word;
+
+	while (len >= 8) {
+		memcpy(&word, bytes, 8);
+		hash ^= word * 0xC2B2AE3D27D4EB4FULL;
+		hash = ((hash << 31) | (hash >> 33)) * 0x9E3779B97F4A7C15ULL;
+		bytes += 8;
+		len -= 8;
+	}
+	word = 0;
+	memcpy(&word, bytes, len);
+	hash ^= word * 0xC2B2AE3D27D4EB4FULL;
+
+	hash ^= hash >> 33;
+	hash *= 0xFF51AFD7ED558CCDULL;
+	hash ^= hash >> 33;
+	hash *= 0xC4CEB9FE1A85EC53ULL;
+	hash ^= hash >> 33;
+	return hash;
+}
+
+
+/*
+ * cachePath(makeFileName) -- Returns a new string with the cache file name for
+ * `makeFileName`: `.<name>.mymake_graph` in the makefile's directory.
+ */
+char *cachePath(char *makeFileName) {
+
+	char *slash = strrchr(makeFileName, '/');
+	char *base = slash ? slash + 1 : makeFileName;
+	size_t dirLen = base - makeFileName;
+	char *path = malloc(strlen(makeFileName) + strlen(".mymake_graph") + 2);
+
+	if (path == NULL) {
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	memcpy(path, makeFileName, dirLen);
+	sprintf(path + dirLen, ".%s.mymake_graph", base);
+	return path;
+}
+
+
+/*
+ * makeFileKey(fp, header) -- Fills in the key fields of `header` from the open makefile `fp`.
+ * Returns `1` on success, or `0` if the makefile is not a regular file.
+ */
+int makeFileKey(FILE *fp, struct graphHeader *header) {
+
+	struct stat fileData;
+
+	if (fstat(fileno(fp), &fileData) != 0 || !S_ISREG(fileData.st_mode)) {
+		return 0;
+	}
+
+	header->makeSize = fileData.st_size;
+	header->makeSec = fileData.st_mtim.tv_sec;
+	header->makeNsec = fileData.st_mtim.tv_nsec;
+	header->makeHash = hashContent("", 0);
+
+	if (fileData.st_size > 0) {
+		void *data = mmap(NULL, fileData.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+
+		if (data == MAP_FAILED) {
+			return 0;
+		}
+		header->makeHash = hashContent(data, fileData.st_size);
+		munmap(data, fileData.st_size);
+	}
+	return 1;
+}
+
+
+/*
+ * cacheMatches(makeFileName, key) -- Returns `1` if the cache file of `makeFileName` has the
+ * makefile key in `key`, reading only its header, and `0` otherwise.
+ */
+static int cacheMatches(char *makeFileName, struct graphHeader *key) {
+
+	char *path = cachePath(makeFileName);
+	int fd = open(path, O_RDONLY);
+	free(path);
+
+	if (fd < 0) {
+		return 0;
+	}
+
+	struct graphHeader header;
+	int same = read(fd, &header, sizeof(header)) == sizeof(header)
+		&& memcmp(header.magic, GRAPH_MAGIC, 8) == 0 && header.makeSize == key->makeSize
+		&& header.makeSec == key->makeSec && header.makeNsec == key->makeNsec
+		&& header.makeHash == key->makeHash;
+
+	close(fd);
+	return same;
+}
+
+
+/*
+ * graphCacheIsCurrent(makeFileName, fp) -- Returns `1` if the cache of `makeFileName` was
+ * written for the open makefile `fp` as it is now, so `loadGraphCache` would use it.
+ */
+int graphCacheIsCurrent(char *makeFileName, FILE *fp) {
+
+	struct graphHeader key;
+
+	return useGraphCache && makeFileKey(fp, &key) && cacheMatches(makeFileName, &key);
+}
+
+
+/*
+ * sectionsAreSound(header, graphNodes, edges, lines, strings) -- Checks every offset and
+ * id of a mapped cache before any of it is used, since a cache cut short or corrupted on
+ * disk could otherwise send the loader outside the mapping. Each name and line must start
+ * inside the string blob, which must end in a terminator, the edges of the nodes must
+ * follow each other through the whole edge array, each node's lines must be inside the
+ * line array, and each edge must lead to a node. Returns `1` if all of it is sound.
+ */
+static int sectionsAreSound(struct graphHeader *header, struct graphNode *graphNodes, uint32_t *edges,
+		uint32_t *lines, char *strings) {
+
+	uint64_t nextEdge = 0;
+	uint32_t index;
+
+	if (header->nodeCount > 0 && (header->stringSize == 0 || strings[header->stringSize - 1] != '\0')) {
+		return 0;
+	}
+
+	for (index = 0; index < header->nodeCount; index++) {
+		struct graphNode *graphNode = &graphNodes[index];
+
+		if (graphNode->nameOffset >= header->stringSize || graphNode->firstEdge != nextEdge
+				|| (uint64_t)graphNode->firstLine + graphNode->lineCount > header->lineCount) {
+			return 0;
+		}
+		nextEdge += graphNode->edgeCount;
+		if (nextEdge > header->edgeCount) {
+			return 0;
+		}
+	}
+	if (nextEdge != header->edgeCount) {
+		return 0;
+	}
+
+	for (index = 0; index < header->edgeCount; index++) {
+		if (edges[index] >= header->nodeCount) {
+			return 0;
+		}
+	}
+	for (index = 0; index < header->lineCount; index++) {
+		if (lines[index] >= header->stringSize) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+/*
+ * loadGraphCache(makeFileName, fp) -- Builds the graph from the cache of `makeFileName`.
+ * Maps the cache file, checks that its key matches the open makefile `fp` and that its
+ * sections are sound (see `sectionsAreSound`), links
+ * arena-allocated nodes and lines to the names and lines inside the mapping, and
+ * copies the edge array straight into the graph, which already has its layout.
+ * Returns `1` if the graph was loaded, or `0` (with nothing loaded) if there is no
+ * usable cache and the makefile has to be parsed.
+ */
+int loadGraphCache(char *makeFileName, FILE *fp) {
+
+	struct graphHeader key;
+
+	if (!useGraphCache || !makeFileKey(fp, &key)) {
+		return 0;
+	}
+
+	char *path = cachePath(makeFileName);
+	int fd = open(path, O_RDONLY);
+	free(path);
+
+	if (fd < 0) {
+		return 0;
+	}
+
+	struct stat fileData;
+	if (fstat(fd, &fileData) != 0 || (size_t)fileData.st_size < sizeof(struct graphHeader)) {
+		close(fd);
+		return 0;
+	}
+
+	char *data = mmap(NULL, fileData.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED) {
+		return 0;
+	}
+
+	struct graphHeader *header = (struct graphHeader *)data;
+	size_t nodesAt = align8(sizeof(struct graphHeader));
+	size_t edgesAt = nodesAt + align8((size_t)header->nodeCount * sizeof(struct graphNode));
+	size_t linesAt = edgesAt + align8((size_t)header->edgeCount * sizeof(uint32_t));
+	size_t stringsAt = linesAt + align8((size_t)header->lineCount * sizeof(uint32_t));
+
+	if (memcmp(header->magic, GRAPH_MAGIC, 8) != 0 || header->makeSize != key.makeSize
+			|| header->makeSec != key.makeSec || header->makeNsec != key.makeNsec
+			|| header->makeHash != key.makeHash
+			|| (header->defaultGoal != GRAPH_NO_GOAL && header->defaultGoal >= header->nodeCount)
+			|| header->stringSize > (uint64_t)fileData.st_size
+			|| stringsAt + header->stringSize != (size_t)fileData.st_size) {
+		munmap(data, fileData.st_size);
+		return 0;
+	}
+
+	struct graphNode *graphNodes = (struct graphNode *)(data + nodesAt);
+	uint32_t *edges = (uint32_t *)(data + edgesAt);
+	uint32_t *lines = (uint32_t *)(data + linesAt);
+	char *strings = data + stringsAt;
+
+	if (!sectionsAreSound(header, graphNodes, edges, lines, strings)) {
+		munmap(data, fileData.st_size);
+		return 0;
+	}
+
+	struct parentNode *nodes = arenaZalloc(header->nodeCount * sizeof(struct parentNode));
+	struct LineNode *lineNodes = arenaAlloc(header->lineCount * sizeof(struct LineNode));
+	uint32_t index;
+
+	tableReserve(header->nodeCount);
+	graph.frozen = 1;
+	graphReserve(header->nodeCount, header->edgeCount);
+	for (index = 0; index < header->nodeCount; index++) {
+		struct graphNode *graphNode = &graphNodes[index];
+		struct parentNode *node = &nodes[index];
+
+		node->name = strings + graphNode->nameOffset;
+		node->nameHash = graphNode->nameHash;
+		addParentNode(node);
+		graph.flags[index].target = (graphNode->flags & GRAPH_TARGET) != 0;
+		graph.flags[index].phony = (graphNode->flags & GRAPH_PHONY) != 0;
+		graph.flags[index].restat = (graphNode->flags & GRAPH_RESTAT) != 0;
+		graph.childStart[index] = graphNode->firstEdge;
+
+		uint32_t line;
+		for (line = 0; line < graphNode->lineCount; line++) {
+			struct LineNode *lineNode = &lineNodes[graphNode->firstLine + line];
+
+			lineNode->line = strings + lines[graphNode->firstLine + line];
+			lineNode->next = line + 1 < graphNode->lineCount ? lineNode + 1 : NULL;
+		}
+		node->cmds = graphNode->lineCount ? &lineNodes[graphNode->firstLine] : NULL;
+	}
+
+	if (header->edgeCount > 0) {
+		memcpy(graph.childIds, edges, (size_t)header->edgeCount * sizeof(uint32_t));
+	}
+	graph.edgeCount = header->edgeCount;
+	freezeGraph();
+
+	if (header->defaultGoal != GRAPH_NO_GOAL) {
+		targetNode = nodes[header->defaultGoal].name;
+	}
+	cacheData = data;
+	cacheSize = fileData.st_size;
+	return 1;
+}
+
+
+/*
+ * writeGraph(out, header) -- Writes the current graph to `out` after `header`,
+ * filling in the section sizes of `header` first. Returns `1` on success.
+ */
+int writeGraph(FILE *out, struct graphHeader *header) {
+
+	struct parentNode *cur;
+	struct LineNode *line;
+	uint64_t zero = 0;
+
+	header->nodeCount = graphSize;
+	header->edgeCount = graph.edgeCount;
+	header->lineCount = 0;
+	header->stringSize = 0;
+	header->defaultGoal = targetNode ? (uint32_t)findParentNode(targetNode)->id : GRAPH_NO_GOAL;
+
+	for (cur = headLL; cur != NULL; cur = cur->next) {
+		header->stringSize += strlen(cur->name) + 1;
+		for (line = cur->cmds; line != NULL; line = line->next) {
+			header->lineCount++;
+			header->stringSize += strlen(line->line) + 1;
+		}
+	}
+
+	int ok = fwrite(header, sizeof(*header), 1, out) == 1;
+	ok = ok && fwrite(&zero, 1, align8(sizeof(*header)) - sizeof(*header), out) == align8(sizeof(*header)) - sizeof(*header);
+
+	// Node table: names first, then each node's lines, in the string blob.
+	uint32_t stringOffset = 0;
+	uint32_t lineIndex = 0;
+
+	for (cur = headLL; cur != NULL && ok; cur = cur->next) {
+		struct graphNode graphNode;
+		memset(&graphNode, 0, sizeof(graphNode));
+
+		graphNode.nameHash = cur->nameHash;
+		graphNode.nameOffset = stringOffset;
+		graphNode.flags = (graph.flags[cur->id].target ? GRAPH_TARGET : 0) | (graph.flags[cur->id].phony ? GRAPH_PHONY : 0)
+				| (graph.flags[cur->id].restat ? GRAPH_RESTAT : 0);
+		graphNode.firstEdge = graph.childStart[cur->id];
+		graphNode.edgeCount = graphChildCount(cur->id);
+		graphNode.firstLine = lineIndex;
+		stringOffset += strlen(cur->name) + 1;
+
+		for (line = cur->cmds; line != NULL; line = line->next) {
+			graphNode.lineCount++;
+			stringOffset += strlen(line->line) + 1;
+		}
+		lineIndex += graphNode.lineCount;
+
+		ok = fwrite(&graphNode, sizeof(graphNode), 1, out) == 1;
+	}
+	size_t pad = align8(graphSize * sizeof(struct graphNode)) - graphSize * sizeof(struct graphNode);
+	ok = ok && fwrite(&zero, 1, pad, out) == pad;
+
+	// The edge array is the graph's own, ids and all.
+	ok = ok && fwrite(graph.childIds, sizeof(uint32_t), header->edgeCount, out) == header->edgeCount;
+	pad = align8(header->edgeCount * sizeof(uint32_t)) - header->edgeCount * sizeof(uint32_t);
+	ok = ok && fwrite(&zero, 1, pad, out) == pad;
+
+	// Line offsets, matching the layout of the string blob below.
+	stringOffset = 0;
+	for (cur = headLL; cur != NULL && ok; cur = cur->next) {
+		stringOffset += strlen(cur->name) + 1;
+		for (line = cur->cmds; line != NULL && ok; line = line->next) {
+			ok = fwrite(&stringOffset, sizeof(stringOffset), 1, out) == 1;
+			stringOffset += strlen(line->line) + 1;
+		}
+	}
+	pad = align8(header->lineCount * sizeof(uint32_t)) - header->lineCount * sizeof(uint32_t);
+	ok = ok && fwrite(&zero, 1, pad, out) == pad;
+
+	for (cur = headLL; cur != NULL && ok; cur = cur->next) {
+		ok = fwrite(cur->name, 1, strlen(cur->name) + 1, out) == strlen(cur->name) + 1;
+		for (line = cur->cmds; line != NULL && ok; line = line->next) {
+			ok = fwrite(line->line, 1, strlen(line->line) + 1, out) == strlen(line->line) + 1;
+		}
+	}
+	return ok;
+}
+
+
+/*
+ * saveGraphCache(makeFileName, fp) -- Writes the graph just parsed from the open
+ * makefile `fp` to the cache of `makeFileName`, unless the cache already holds the
+ * graph of this exact makefile. The file is written under a temporary name and
+ * renamed into place. Failing to write it is not an error.
+ */
+void saveGraphCache(char *makeFileName, FILE *fp) {
+
+	struct graphHeader header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GRAPH_MAGIC, 8);
+
+	if (!useGraphCache || !makeFileKey(fp, &header)) {
+		return;
+	}
+	// Offsets are 32 bits wide.
+	if (header.makeSize > UINT32_MAX / 2) {
+		return;
+	}
+
+	if (cacheMatches(makeFileName, &header)) {
+		return;
+	}
+
+	char *path = cachePath(makeFileName);
+	char *tempPath = malloc(strlen(path) + 5);
+
+	if (tempPath == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	sprintf(tempPath, "%s.tmp", path);
+
+	FILE *out = fopen(tempPath, "wb");
+	if (out != NULL) {
+		int ok = writeGraph(out, &header);
+
+		if (fclose(out) != 0 || !ok || rename(tempPath, path) != 0) {
+			remove(tempPath);
+		}
+	}
+	free(tempPath);
+	free(path);
+}
+
+
+/*
+ * releaseGraphCache() -- Unmaps the cache file the current graph was loaded from, if any.
+ * Called by `freeLL()`, since node names and lines point into the mapping.
+ */
+void releaseGraphCache() {
+
+	if (cacheData != NULL) {
+		munmap(cacheData, cacheSize);
+		cacheData = NULL;
+		cacheSize = 0;
+	}
+}
@@ -3,7 +3,7 @@
 * Author: Chance Krueger
 * Purpose: Defines the structures and function prototypes for
 * a graph-based makefile parser, including parent nodes,
-* child nodes, and command line nodes.
+* the arrays of the graph, and command line nodes.
 */
 
 
@@ -15,11 +15,15 @@
 #include <stdlib.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#include <sys/types.h>
+#include <stdint.h>
+#include <time.h>
 
 // Forward declarations
-struct childNode;
 struct parentNode;
 struct LineNode;
+struct buildRecord;
+struct contentRecord;
 
 /*
  * struct LineNode -- Represents a single command in a target's command list.
@@ -31,63 +35,291 @@ struct LineNode {
 };
 
 /*
- * struct parentNode -- Represents a target in the dependency graph.
+ * struct parentNode -- The cold data of a target or file in the dependency graph.
+ * Everything the traversal and the scheduler touch for every node lives in the
+ * arrays of `struct graph` instead, indexed by `id`.
  * Stores:
  *   - `name`: The name of the target.
  *   - `cmds`: A linked list of commands to execute for this target.
- *   - `children`: A linked list of dependencies (edges to child nodes).
  *   - `next`: Pointer to the next target in the list.
- *   - `visited`: Flag for traversal to detect cycles.
- *   - `doesExist`: Flag indicating whether the target file exists.
- *   - `mustBuild`: Flag indicating if this target needs to be rebuilt.
- *   - `completed`: Flag marking if traversal for this node is finished.
- *   - `fileDate`: Timestamp of the last modification (from `stat()`).
- *   - `target`: Flag indicating if this node is a target in the makefile.
+ *   - `fileIno`: Inode number of the file (from `stat()`).
+ *   - `fileSize`: Size of the file in bytes (from `stat()`).
+ *   - `statError`: The `errno` of the failed probe when the file is missing.
+ *   - `id`: Dense node number, the position of the node in `headLL`.
+ *   - `record`: What the build database remembers about this target, or `NULL`.
+ *   - `content`: The content hash of the file in `--hash` mode, or `NULL`.
+ *   - `nameHash`: Hash of `name`, cached for the target table.
+ *   - `hashNext`: Pointer to the next node in the same target table bucket.
  */
 struct parentNode {
 	
 	char *name;
 	struct LineNode *cmds;
-	struct childNode *children;
 	struct parentNode *next;
-	int visited;
-	int doesExist;
-	int mustBuild;
-	int completed;
-	time_t fileDate;
-	int target;
+	ino_t fileIno;
+	off_t fileSize;
+	int statError;
+	int id;
+	struct buildRecord *record;
+	struct contentRecord *content;
+	unsigned long nameHash;
+	struct parentNode *hashNext;
+
+};
+
+
+/*
+ * struct nodeFlags -- The flags of one node, packed into two bytes.
+ * Stores:
+ *   - `target`: Flag indicating if this node is a target in the makefile.
+ *   - `phony`: Flag indicating the target was declared `.PHONY`, so it names no file.
+ *   - `restat`: Flag indicating the target was declared `.RESTAT`, so an output its
+ *     recipe left unchanged does not make its dependents out of date.
+ *   - `visited`: Flag for traversal to detect cycles.
+ *   - `completed`: Flag marking if traversal for this node is finished.
+ *   - `doesExist`: Flag indicating whether the target file exists.
+ *   - `mustBuild`: Flag indicating if this target needs to be rebuilt.
+ *   - `statState`: Stat cache state: `STAT_UNKNOWN`, `STAT_EXISTS` or `STAT_MISSING`.
+ */
+struct nodeFlags {
+
+	unsigned char target : 1;
+	unsigned char phony : 1;
+	unsigned char visited : 1;
+	unsigned char completed : 1;
+	unsigned char doesExist : 1;
+	unsigned char mustBuild : 1;
+	unsigned char statState : 2;
+	unsigned char restat : 1;
+
+};
+
+#define STAT_UNKNOWN 0
+#define STAT_EXISTS 1
+#define STAT_MISSING 2
+
+// The build database of a makefile `mk` is `.mk` followed by this, next to it.
+#define DB_SUFFIX ".mymake_db"
+
+
+/*
+ * struct graph -- The dependency graph as parallel arrays indexed by node id.
+ * Stores:
+ *   - `nodes`: The `parentNode` of each id, for its name, commands and records.
+ *   - `flags`: The packed flags of each node.
+ *   - `mtime`: Timestamp of the last modification, to the nanosecond (from `stat()`).
+ *   - `pending`: Number of prerequisites that must finish before the node can run.
+ *   - `order`: Post-order position, used to order the ready queue.
+ *   - `childStart`, `childIds`: The prerequisites of node `id` are
+ *     `childIds[childStart[id]]` up to `childIds[childStart[id + 1]]`, in makefile order.
+ *   - `parentStart`, `parentIds`, `parentEdge`: The same for the nodes that depend on
+ *     each node, with the index in `childIds` of the edge each entry mirrors.
+ *   - `dropped`: For each edge in `childIds`, whether the traversal dropped it because
+ *     it closes a cycle.
+ *   - `edgeCount`: Number of edges.
+ *   - `frozen`: Flag marking that the edges are in the layout above. Until `freezeGraph`
+ *     sets it, while a makefile is parsed, `childStart[id]` is instead the number of edges
+ *     of `id`, and `childIds` holds the edges in the order they were added, not by id.
+ *     `freezeGraph` turns the counts into start offsets with a prefix sum and sorts the
+ *     edges into place. A graph loaded from its cache is in the frozen layout from the start.
+ */
+struct graph {
+
+	struct parentNode **nodes;
+	struct nodeFlags *flags;
+	struct timespec *mtime;
+	int *pending;
+	int *order;
+	int *childStart;
+	int *childIds;
+	int *parentStart;
+	int *parentIds;
+	int *parentEdge;
+	unsigned char *dropped;
+	int edgeCount;
+	int frozen;
 
 };
 
 
 /*
- * struct childNode -- Represents an edge in the dependency graph.
+ * struct buildRecord -- What the build database remembers about a target.
  * Stores:
- *   - `to`: Pointer to the dependent `parentNode`.
- *   - `next`: Pointer to the next dependency in the list.
+ *   - `recipeHash`: Hash of the command lines at the last successful build.
+ *   - `inputHash`: Hash of the prerequisites' names and mtimes at that build.
+ *   - `output`: The target's own mtime after that build.
+ *   - `duration`: How long its recipe took to run last time, in nanoseconds (`0` if unknown).
+ *   - `dirty`: Flag marking a record that still has to be written to disk.
  */
-struct childNode {
+struct buildRecord {
 
-	struct parentNode *to;
-	struct childNode *next;
+	unsigned long recipeHash;
+	unsigned long inputHash;
+	struct timespec output;
+	long long duration;
+	int dirty;
+
+};
+
+
+/*
+ * struct contentRecord -- The content hash of a file and the key it was computed for.
+ * Stores:
+ *   - `ino`, `size`, `mtime`: The inode, size and mtime of the file when it was hashed.
+ *   - `hash`: The hash of the file's contents.
+ *   - `valid`: Flag marking a record whose hash was computed successfully.
+ */
+struct contentRecord {
+
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	unsigned long hash;
+	int valid;
 
 };
 
 
 // Global Varible
 extern struct parentNode *headLL;
+extern struct parentNode *tailLL;
 extern char *targetNode;
 extern char *curLine;
+extern int useMmap;
+extern int graphSize;
+extern long arenaChunks;
+extern int CMDSused;
+extern int jobSlots;
+extern int shellOnly;
+extern int spawnStats;
+extern int statStats;
+extern char *buildDbPath;
+extern struct graph graph;
 
 
 // Function prototypes
 int parseMakeFileData(FILE *fp); // return 1 if errSeen, 0 if not. If fatal error, exit program and return 1;
 void addNodeToGraph(struct parentNode *node);
+struct parentNode *internNode(const char *name, size_t len);
+struct parentNode *useActionLineAndAddNodes(char *line, char *eol);
+char *parseRule(char *line, char *end);
+void finishParse();
 
-int parseTargetFileData(char *fp); // return 1 if errSeen, 0 if not. If fatal error, exit program and return 1;
+extern int useLazyParse;
+extern int partialGraph;
+int parseGoals(char *makeFileName, FILE *fp, char **names, int count);
+
+int parseTargetFileData(char **names, int count); // return 1 if errSeen, 0 if not. If fatal error, exit program and return 1;
 void PostOrder(struct parentNode *node); // PRINT TREE IN POSTORDER (target from parseTargetFileData)
 struct parentNode *findParentNode(char *name);
-void freeLines(struct LineNode *head);
+struct parentNode *verifyTargetNode(char *name);
+void POT(int id);
+int buildGoals(struct parentNode **targets, int count);
+struct parentNode **findGoals(char **names, int count);
+void reportUpToDate(char **names, struct parentNode **targets, int count);
+int watchGoals(char *makeFileName, char **names, int count);
 void freeLL();
+struct parentNode *newParentNode(const char *name, size_t len);
+void addParentNode(struct parentNode *node);
+
+void graphAddNode(struct parentNode *node);
+void graphAddEdge(int parent, int child);
+int graphChildCount(int id);
+void graphReserve(int nodeCount, int edgeCount);
+void freezeGraph();
+void freeGraph();
+size_t graphBytes();
+
+void *arenaAlloc(size_t size);
+void *arenaZalloc(size_t size);
+char *arenaStrndup(const char *text, size_t len);
+void arenaFree();
+
+void pushReady(int id);
+void scheduleNode(int id);
+int runJobs();
+
+extern int oneShell;
+pid_t runLine(char *line, int *direct, int output);
+pid_t runScript(struct LineNode *line, int *count, int output);
+double elapsedNanos(struct timespec *start);
+void recordLineTime(int direct, double nanos);
+void printSpawnStats();
+
+extern int captureOutput;
+extern int streamOutput;
+void openCapture(int slots);
+int capturePipe(int slot);
+void captureStarted(int slot, pid_t pid, int writeEnd);
+pid_t waitChild(int *status, int timeout);
+void captureText(int slot, const char *text);
+void flushCapture(int slot);
+void closeCapture();
+
+extern double maxLoad;
+extern long memoryFloor;
+extern char *procDir;
+int mayStartJob();
+void closeThrottle();
+
+void runPool(void *(*worker)(void *), long threads);
+
+int compareTime(struct timespec first, struct timespec second);
+extern long statCalls;
+void storeStat(int id, struct stat *fileData, int error);
+int statNode(int id);
+void forgetStat(int id);
+void printStatStats();
+
+extern int usePrefetch;
+extern int useIoUring;
+void prefetchStats(struct parentNode **targets, int count);
+void printPrefetchStats();
+
+void setBuildDatabase(char *makeFileName);
+void recordDuration(int id, double nanos);
+void loadBuildDatabase();
+int recordIsCurrent(int id);
+void recordBuild(int id);
+void saveBuildDatabase();
+
+extern int useGraphCache;
+int graphCacheIsCurrent(char *makeFileName, FILE *fp);
+int loadGraphCache(char *makeFileName, FILE *fp);
+void saveGraphCache(char *makeFileName, FILE *fp);
+void releaseGraphCache();
+
+extern int useHash;
+uint64_t hashContent(const void *data, size_t len);
+int contentHashOf(int id, unsigned long *hash);
+void hashInputs();
+void loadHashCache();
+void saveHashCache();
+void printHashStats();
+
+extern char *actionCacheDir;
+extern long actionCacheLimit;
+unsigned long recipeHash(struct parentNode *node);
+void openActionCache();
+int actionKey(int id, unsigned long *key);
+int restoreAction(int id, unsigned long key);
+void storeAction(int id, unsigned long key);
+void closeActionCache();
+
+extern FILE *traceFile;
+void openTrace(char *path);
+void closeTrace();
+void tracePhase(const char *name, struct timespec *start);
+void traceStat(int id, struct timespec *start);
+void tracePrefetchedStat(int id);
+void traceDecision(int id, const char *reason, int other);
+void traceLine(char *line, int id, int slot, pid_t pid, struct timespec *start, int status);
+
+unsigned long hashBytes(unsigned long hash, const void *data, size_t len);
+unsigned long hashName(const char *name, size_t len);
+struct parentNode *tableFind(const char *name, size_t len);
+void tableInsert(struct parentNode *node);
+void tableReserve(size_t count);
+void tableFree();
 
 #endif
\ No newline at end of file
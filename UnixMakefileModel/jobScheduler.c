@@ -0,0 +1,615 @@
+/*
+* File: jobScheduler.c
+* Author: Chance Krueger
+* Purpose: Defines the ready-queue scheduler that executes the
+* dependency graph. `POT` counts the unfinished prerequisites of
+* every reachable node and hands each node to `scheduleNode`. Nodes
+* with no unfinished prerequisites wait in a ready queue until one
+* of the `jobSlots` worker slots is free, their recipe lines run as
+* child processes started by `runLine` (or all of them as one script
+* started by `runScript` with `--one-shell`), and finished children are
+* reaped with `waitChild` so that their dependents can be released.
+* With more than one slot, each target's output is collected by the
+* output layer and printed as one block when the target is done.
+*/
+
+
+# include "header.h"
+# include <time.h>
+# include <sys/wait.h>
+
+// How often, in milliseconds, the load and memory are read again while new recipes are held back.
+#define THROTTLE_RECHECK 250
+
+/*
+ * struct job -- A worker slot. Stores the process running the current
+ * recipe line (`pid`), the node being built (`node`), the line that
+ * process is running (`line`), when it was started (`start`) and whether
+ * it was started without a shell (`direct`). If the process runs the whole
+ * recipe as one script, `line` is its first line and `lines` counts its lines,
+ * otherwise `lines` is `0`. `began` is when the first line of the recipe was
+ * started. If the output goes to the action cache once the recipe succeeds,
+ * `cacheable` is set and `key` is its cache key. For a `.RESTAT` target whose
+ * output existed, `restat` is set, `before` is the output's mtime before the
+ * recipe, and `content` its content hash if `hashed` is set. A slot is free
+ * when `node` is `-1`.
+ */
+struct job {
+	pid_t pid;
+	int node;
+	struct LineNode *line;
+	struct timespec start;
+	struct timespec began;
+	int direct;
+	int lines;
+	int cacheable;
+	unsigned long key;
+	int restat;
+	struct timespec before;
+	int hashed;
+	unsigned long content;
+};
+
+// GLOBAL VARIBLES
+int jobSlots = 1;
+
+static struct job *jobs = NULL;
+static int running = 0;
+static int failed = 0;
+
+static int *ready = NULL;
+static int readyCount = 0;
+static int readySize = 0;
+static int nextOrder = 0;
+static long long *pathCost = NULL;
+
+
+/*
+ * runsBefore(first, second) -- Returns whether ready node `first` should start before
+ * `second`: the one with the longer `pathCost`, if known, and otherwise the one that
+ * comes first in post-order.
+ */
+static int runsBefore(int first, int second) {
+
+	if (pathCost != NULL && pathCost[first] != pathCost[second]) {
+		return pathCost[first] > pathCost[second];
+	}
+	return graph.order[first] < graph.order[second];
+}
+
+
+/*
+ * pushReady(id) -- Adds node `id` to the ready queue.
+ * The queue is a binary heap ordered by `runsBefore`, so with one slot nodes
+ * run in the same post-order that the recursive traversal used to build them.
+ * Exits if memory allocation fails.
+ */
+void pushReady(int id) {
+
+	if (readyCount == readySize) {
+		readySize = readySize ? readySize * 2 : 64;
+		ready = realloc(ready, readySize * sizeof(int));
+
+		if (ready == NULL) {
+			freeLL();
+			fprintf(stderr, "Ran Out of Memory.\n");
+			exit(1);
+		}
+	}
+
+	int index = readyCount++;
+	while (index > 0) {
+		int parent = (index - 1) / 2;
+
+		if (!runsBefore(id, ready[parent])) {
+			break;
+		}
+		ready[index] = ready[parent];
+		index = parent;
+	}
+	ready[index] = id;
+}
+
+
+/*
+ * popReady() -- Removes and returns the id of the ready node that runs first.
+ * Assumes the queue is not empty.
+ */
+int popReady() {
+
+	int top = ready[0];
+	int last = ready[--readyCount];
+
+	int index = 0;
+	while (2 * index + 1 < readyCount) {
+		int child = 2 * index + 1;
+
+		if (child + 1 < readyCount && runsBefore(ready[child + 1], ready[child])) {
+			child++;
+		}
+		if (!runsBefore(ready[child], last)) {
+			break;
+		}
+		ready[index] = ready[child];
+		index = child;
+	}
+	if (readyCount > 0) {
+		ready[index] = last;
+	}
+	return top;
+}
+
+
+/*
+ * scheduleNode(id) -- Called by `POT` once the traversal of node `id` is complete.
+ * Records the post-order position of the node and queues it if all of its
+ * prerequisites are already accounted for.
+ */
+void scheduleNode(int id) {
+
+	graph.order[id] = nextOrder++;
+
+	if (graph.pending[id] == 0) {
+		pushReady(id);
+	}
+}
+
+
+/*
+ * nextLine(line) -- Returns the first non-empty command at or after `line`,
+ * or `NULL` if there is none.
+ */
+struct LineNode *nextLine(struct LineNode *line) {
+
+	while (line != NULL && line->line[0] == 0) {
+		line = line->next;
+	}
+	return line;
+}
+
+
+/*
+ * weighPaths() -- Computes `pathCost` for every node reached by `POT`: the time its
+ * recipe took at its last build, plus the longest `pathCost` among the nodes that depend
+ * on it, so the longest chain of recipes still to run above each node. A recipe that
+ * was never timed counts as the average of those that were, and a node without one
+ * counts as nothing. Nodes are weighed in reverse post-order, which puts every
+ * dependent before its prerequisites, and the ready queue is then rebuilt in the new
+ * order. Leaves `pathCost` unset if no recipe was ever timed.
+ */
+static void weighPaths() {
+
+	long long known = 0;
+	long timed = 0;
+	int id;
+
+	for (id = 0; id < graphSize; id++) {
+		struct buildRecord *record = graph.nodes[id]->record;
+
+		if (graph.flags[id].visited && record != NULL && record->duration > 0) {
+			known += record->duration;
+			timed++;
+		}
+	}
+	if (timed == 0) {
+		return;
+	}
+
+	int *byOrder = malloc(nextOrder * sizeof(int));
+	pathCost = malloc(graphSize * sizeof(long long));
+
+	if (byOrder == NULL || pathCost == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	for (id = 0; id < graphSize; id++) {
+		if (graph.flags[id].visited) {
+			byOrder[graph.order[id]] = id;
+		}
+	}
+
+	int position;
+	for (position = nextOrder - 1; position >= 0; position--) {
+		id = byOrder[position];
+		struct buildRecord *record = graph.nodes[id]->record;
+		long long longest = 0;
+		int at;
+
+		for (at = graph.parentStart[id]; at < graph.parentStart[id + 1]; at++) {
+			int dependent = graph.parentIds[at];
+
+			if (graph.flags[dependent].visited && !graph.dropped[graph.parentEdge[at]]
+					&& pathCost[dependent] > longest) {
+				longest = pathCost[dependent];
+			}
+		}
+		if (nextLine(graph.nodes[id]->cmds) != NULL) {
+			longest += record != NULL && record->duration > 0 ? record->duration : known / timed;
+		}
+		pathCost[id] = longest;
+	}
+	free(byOrder);
+
+	// Nodes queued during the traversal were placed by post-order alone.
+	int count = readyCount;
+	readyCount = 0;
+	for (position = 0; position < count; position++) {
+		pushReady(ready[position]);
+	}
+}
+
+
+/*
+ * startLine(job) -- Starts `job->line` and records when and how it was started.
+ * With `--one-shell`, a recipe with more than one line is started as one script
+ * instead. While output is captured, the process writes to the slot's pipe. If the
+ * line cannot be started the build is marked as failed and the slot is freed. Returns `0` on success and `-1` on failure.
+ */
+int startLine(struct job *job) {
+
+	int slot = job - jobs;
+	int output = capturePipe(slot);
+
+	clock_gettime(CLOCK_MONOTONIC, &job->start);
+	job->lines = 0;
+
+	if (oneShell && nextLine(job->line->next) != NULL) {
+		job->pid = runScript(job->line, &job->lines, output);
+		job->direct = 2;
+	} else {
+		job->pid = runLine(job->line->line, &job->direct, output);
+	}
+	captureStarted(slot, job->pid, output);
+
+	if (job->pid < 0) {
+		traceLine(job->line->line, job->node, slot, job->pid, &job->start, -1);
+		flushCapture(slot);
+		failed = 1;
+		job->node = -1;
+		running--;
+		return -1;
+	}
+	return 0;
+}
+
+
+/*
+ * finishPhony(id, ran) -- Decides how a finished phony target looks to its dependents,
+ * without touching the file system. If its recipe ran it counts as missing, which
+ * rebuilds every dependent. A phony target with no recipe only groups its prerequisites,
+ * so it takes the newest of their mtimes and dependents rebuild only if one of those
+ * is newer than they are; it counts as missing only if one of them is.
+ */
+void finishPhony(int id, int ran) {
+
+	struct nodeFlags *flags = &graph.flags[id];
+	int edge;
+
+	flags->doesExist = !ran;
+	graph.mtime[id].tv_sec = 0;
+	graph.mtime[id].tv_nsec = 0;
+
+	for (edge = graph.childStart[id]; edge < graph.childStart[id + 1] && flags->doesExist; edge++) {
+		int child = graph.childIds[edge];
+
+		if (!graph.flags[child].doesExist) {
+			flags->doesExist = 0;
+		} else if (compareTime(graph.mtime[child], graph.mtime[id]) > 0) {
+			graph.mtime[id] = graph.mtime[child];
+		}
+	}
+}
+
+
+/*
+ * releaseDependents(id) -- Each dependent the traversal reached through an edge it
+ * kept compares itself against the finished node `id`, and is queued once its last
+ * prerequisite has finished.
+ */
+static void releaseDependents(int id) {
+
+	struct nodeFlags *flags = &graph.flags[id];
+	int at;
+
+	for (at = graph.parentStart[id]; at < graph.parentStart[id + 1]; at++) {
+		int dependent = graph.parentIds[at];
+		struct nodeFlags *dependentFlags = &graph.flags[dependent];
+
+		if (!dependentFlags->visited || graph.dropped[graph.parentEdge[at]]) {
+			continue;
+		}
+		if (!dependentFlags->mustBuild) {
+			if (!flags->doesExist) {
+				dependentFlags->mustBuild = 1;
+				traceDecision(dependent, "prerequisite is missing", id);
+			} else if (compareTime(graph.mtime[id], graph.mtime[dependent]) > 0) {
+				dependentFlags->mustBuild = 1;
+				traceDecision(dependent, "prerequisite is newer", id);
+			}
+		}
+		graph.pending[dependent]--;
+		if (graph.pending[dependent] == 0) {
+			pushReady(dependent);
+		}
+	}
+}
+
+
+/*
+ * finishNode(id, ran) -- Marks node `id` as built and releases its dependents.
+ * If any recipe line ran (`ran`), the cached timestamp is dropped and the node
+ * is stat'ed again; otherwise nothing can have changed and the cached result
+ * is used. Phony targets are handled by `finishPhony` instead. The result is
+ * remembered in the build database before the dependents are released.
+ */
+void finishNode(int id, int ran) {
+
+	struct nodeFlags *flags = &graph.flags[id];
+
+	if (flags->phony) {
+		finishPhony(id, ran);
+	} else if (flags->mustBuild) {
+		if (ran) {
+			forgetStat(id);
+		}
+		if (statNode(id) != 0 && !flags->target) {
+			perror("stat");
+			freeLL();
+			exit(1);
+		}
+	}
+
+	recordBuild(id);
+	releaseDependents(id);
+}
+
+
+/*
+ * finishUnchanged(id, before) -- Marks the `.RESTAT` target `id`, whose recipe left its
+ * output as it was, as built. The build database records the new mtime, so the target
+ * is up to date in later runs, and its dependents record its content rather than its
+ * mtime. For the rest of this run the target keeps its old mtime `before` in memory,
+ * so the dependents released here do not look out of date because of it. The file
+ * itself is not touched.
+ */
+static void finishUnchanged(int id, struct timespec before) {
+
+	recordBuild(id);
+	graph.mtime[id] = before;
+	releaseDependents(id);
+}
+
+
+/*
+ * startNode(id) -- Takes a ready node and either finishes it right away
+ * (nothing to run) or starts its first recipe line in a free worker slot.
+ * If the build database knows the node, its verdict replaces the one from
+ * comparing mtimes. A node with a recipe to run is first looked up in the
+ * action cache, and finished without running anything if its output can be
+ * restored from there. Assumes a slot is free.
+ */
+void startNode(int id) {
+
+	struct nodeFlags *flags = &graph.flags[id];
+	struct LineNode *line = NULL;
+	int current = recordIsCurrent(id);
+
+	if (current >= 0) {
+		flags->mustBuild = !current;
+		traceDecision(id, current ? "build database: unchanged" : "build database: recipe or inputs changed", -1);
+	}
+
+	if (flags->mustBuild) {
+		line = nextLine(graph.nodes[id]->cmds);
+	}
+	traceDecision(id, !flags->mustBuild ? "up to date" : line != NULL ? "run recipe" : "no recipe", -1);
+
+	if (line == NULL) {
+		finishNode(id, 0);
+		return;
+	}
+
+	unsigned long key = 0;
+	int cacheable = actionKey(id, &key);
+
+	if (cacheable && restoreAction(id, key)) {
+		traceDecision(id, "action cache hit", -1);
+		CMDSused++;
+		finishNode(id, 1);
+		return;
+	}
+
+	int slot = 0;
+	while (jobs[slot].node >= 0) {
+		slot++;
+	}
+	jobs[slot].restat = flags->restat && flags->doesExist;
+	if (jobs[slot].restat) {
+		jobs[slot].before = graph.mtime[id];
+		jobs[slot].hashed = contentHashOf(id, &jobs[slot].content);
+	}
+
+	jobs[slot].node = id;
+	jobs[slot].line = line;
+	jobs[slot].cacheable = cacheable;
+	jobs[slot].key = key;
+	clock_gettime(CLOCK_MONOTONIC, &jobs[slot].began);
+	running++;
+	startLine(&jobs[slot]);
+}
+
+
+/*
+ * outputUnchanged(job) -- Called when the recipe of a `.RESTAT` target succeeded. Returns
+ * `1` if its output is as it was before the recipe ran: either not written at all, or
+ * rewritten with the same contents. Returns `0` otherwise. The node is stat'ed again
+ * either way.
+ */
+static int outputUnchanged(struct job *job) {
+
+	int id = job->node;
+	unsigned long content;
+
+	forgetStat(id);
+	if (statNode(id) != 0) {
+		return 0;
+	}
+	if (compareTime(graph.mtime[id], job->before) == 0) {
+		return 1;
+	}
+	return job->hashed && contentHashOf(id, &content) && content == job->content;
+}
+
+
+/*
+ * reapJob(timeout) -- Waits for one running recipe line to exit, for at most
+ * `timeout` milliseconds (`-1` for as long as it takes).
+ * On success the line is printed (into the target's output block while output
+ * is captured) and the slot moves on to the next line of
+ * the same target, or finishes the target if it was the last one or the
+ * process ran the whole recipe as a script, and keeps its output in the action
+ * cache. A `.RESTAT` target whose output did not change is traced as such and
+ * finished by `finishUnchanged`. The block is printed once the target is
+ * done, whether it succeeded or not. On failure no further work is started.
+ */
+void reapJob(int timeout) {
+
+	int status;
+	pid_t pid = waitChild(&status, timeout);
+
+	if (pid == 0) {
+		return;
+	}
+	if (pid < 0) {
+		perror("waitpid");
+		freeLL();
+		exit(1);
+	}
+
+	int slot = 0;
+	while (slot < jobSlots && jobs[slot].pid != pid) {
+		slot++;
+	}
+	if (slot == jobSlots) {
+		return;
+	}
+
+	struct job *job = &jobs[slot];
+	recordLineTime(job->direct, elapsedNanos(&job->start));
+	traceLine(job->line->line, job->node, slot, pid, &job->start, WIFEXITED(status) ? WEXITSTATUS(status) : -1);
+
+	if (status != 0) {
+		flushCapture(slot);
+		failed = 1;
+		job->node = -1;
+		running--;
+		return;
+	}
+
+	// A script has already printed its lines as they finished.
+	if (job->lines > 0) {
+		CMDSused += job->lines;
+		job->line = NULL;
+	} else {
+		captureText(slot, job->line->line);
+		CMDSused++;
+		job->line = nextLine(job->line->next);
+	}
+
+	if (job->line != NULL && !failed) {
+		startLine(job);
+		return;
+	}
+
+	int unchanged = !failed && job->restat && outputUnchanged(job);
+
+	if (unchanged) {
+		traceDecision(job->node, "restat: output unchanged", -1);
+	}
+	flushCapture(slot);
+
+	int node = job->node;
+	job->node = -1;
+	running--;
+
+	if (!failed) {
+		if (unchanged) {
+			finishUnchanged(node, job->before);
+		} else {
+			finishNode(node, 1);
+		}
+		recordDuration(node, elapsedNanos(&job->began));
+		if (job->cacheable) {
+			storeAction(node, job->key);
+		}
+	}
+}
+
+
+/*
+ * runJobs() -- Builds every node queued by `POT` using up to `jobSlots` processes.
+ * With more than one slot, the ready nodes on the longest timed path to the goals
+ * start first (see `weighPaths`), since that path decides when the build can end.
+ * Keeps the worker slots full from the ready queue and reaps finished lines
+ * until nothing is left to run. If a command fails, waits for the lines
+ * that are still running and starts nothing else. While the load or memory
+ * limits hold new recipes back (see `mayStartJob`), the readings are taken
+ * again every `THROTTLE_RECHECK` milliseconds as well as whenever a line
+ * exits. Returns `1` if a command failed and `0` otherwise.
+ */
+int runJobs() {
+
+	failed = 0;
+	jobs = calloc(jobSlots, sizeof(struct job));
+
+	if (jobs == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+
+	int slot;
+	for (slot = 0; slot < jobSlots; slot++) {
+		jobs[slot].node = -1;
+	}
+	if (jobSlots > 1) {
+		weighPaths();
+	}
+	openCapture(jobSlots);
+
+	while (!failed && (readyCount > 0 || running > 0)) {
+		int held = 0;
+
+		while (!failed && running < jobSlots && readyCount > 0) {
+			// One recipe always runs, so a busy machine slows the build down but never stalls it.
+			if (running > 0 && !mayStartJob()) {
+				held = 1;
+				break;
+			}
+			startNode(popReady());
+		}
+		if (running > 0) {
+			reapJob(held ? THROTTLE_RECHECK : -1);
+		}
+	}
+
+	// Let the commands already started finish before giving up.
+	while (running > 0) {
+		reapJob(-1);
+	}
+
+	closeCapture();
+	closeThrottle();
+	printSpawnStats();
+	free(jobs);
+	free(ready);
+	free(pathCost);
+	jobs = NULL;
+	ready = NULL;
+	pathCost = NULL;
+	readyCount = 0;
+	readySize = 0;
+	nextOrder = 0;
+	return failed;
+}
@@ -0,0 +1,610 @@
+/*
+* File: outputCapture.c
+* Author: Chance Krueger
+* Purpose: Defines the output layer used while more than one recipe
+* runs at a time. Each recipe line writes its stdout and stderr into
+* a pipe owned by its worker slot instead of the terminal. The output
+* is moved with `splice` from the pipe into a memory file holding the
+* target's block, together with the commands printed after each line,
+* and written out in one piece with `sendfile` once the target is done.
+* Blocks are printed in the order their targets started, so a block
+* that is done early waits for the targets started before it, and the
+* log does not depend on which parallel recipe happened to finish
+* first. With `--stream-output`,
+* one target at a time is in the foreground instead: its output is
+* passed straight on to stdout as it comes, and the blocks of targets
+* that finish meanwhile are printed once it is done. Either way the
+* pipes are drained while recipes run, so a slow terminal does not
+* stall them.
+*/
+
+
+#define _GNU_SOURCE
+# include "header.h"
+# include <errno.h>
+# include <limits.h>
+# include <fcntl.h>
+# include <poll.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/sendfile.h>
+# include <sys/syscall.h>
+# include <sys/wait.h>
+
+#define MOVE_CHUNK (64 * 1024)
+
+/*
+ * struct slotOutput -- The output of one worker slot. Stores the memory file
+ * holding the block of the target it is building (`block`, `-1` until first
+ * used), the read end of the pipe the running line writes to (`pipe`), a pidfd
+ * of that line's process (`pidfd`), which wakes `waitChild` when it exits, its pid
+ * (`pid`) and the order in which the target started (`seq`, `-1` while the slot
+ * builds nothing). Closed descriptors are `-1`.
+ */
+struct slotOutput {
+	int block;
+	int pipe;
+	int pidfd;
+	pid_t pid;
+	long seq;
+};
+
+/*
+ * struct doneRange -- The block of a target that was done before a target started
+ * earlier: where it is in `doneBlock` (`offset`, `size`) and the order in which its
+ * target started (`seq`).
+ */
+struct doneRange {
+	long seq;
+	off_t offset;
+	off_t size;
+};
+
+// GLOBAL VARIBLES
+int captureOutput = 1;
+int streamOutput = 0;
+
+static struct slotOutput *outputs = NULL;
+static int outputCount = 0;
+static int capturing = 0;
+static int foreground = -1;
+
+// Blocks of targets that are done but not printed yet.
+static int doneBlock = -1;
+static struct doneRange *doneRanges = NULL;
+static int doneCount = 0;
+static int doneSize = 0;
+static long nextSeq = 0;
+
+
+/*
+ * openCapture(slots) -- Prepares one output block per worker slot if output is captured,
+ * which it is with `captureOutput` on and more than one slot. Exits if memory allocation fails.
+ */
+void openCapture(int slots) {
+
+	capturing = captureOutput && slots > 1;
+	if (!capturing) {
+		return;
+	}
+
+	outputs = malloc(slots * sizeof(struct slotOutput));
+	if (outputs == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	outputCount = slots;
+
+	int slot;
+	for (slot = 0; slot < slots; slot++) {
+		outputs[slot].block = -1;
+		outputs[slot].pipe = -1;
+		outputs[slot].pidfd = -1;
+		outputs[slot].pid = -1;
+		outputs[slot].seq = -1;
+	}
+	nextSeq = 0;
+}
+
+
+/*
+ * openBlock() -- Returns a new, empty memory file for an output block, or an unlinked
+ * temporary file if memory files are not supported, or `-1` if neither can be made.
+ */
+static int openBlock() {
+
+	int fd = memfd_create("mymake-output", MFD_CLOEXEC);
+
+	if (fd < 0) {
+		char path[] = "/tmp/mymakeOutputXXXXXX";
+
+		fd = mkostemp(path, O_CLOEXEC);
+		if (fd >= 0) {
+			unlink(path);
+		}
+	}
+	return fd;
+}
+
+
+/*
+ * writeAll(fd, data, len) -- Writes all `len` bytes at `data` to `fd`, waiting for it
+ * as needed. Returns `1` on success and `0` on a write error.
+ */
+static int writeAll(int fd, const char *data, size_t len) {
+
+	while (len > 0) {
+		ssize_t wrote = write(fd, data, len);
+
+		if (wrote < 0 && errno == EINTR) {
+			continue;
+		}
+		if (wrote <= 0) {
+			return 0;
+		}
+		data += wrote;
+		len -= wrote;
+	}
+	return 1;
+}
+
+
+/*
+ * sendRange(to, from, offset, size) -- Appends the `size` bytes at `offset` in the file
+ * `from` to `to`, after anything already printed to stdout. Uses `sendfile` where the
+ * kernel can, so the data is not copied through this process.
+ */
+static void sendRange(int to, int from, off_t offset, off_t size) {
+
+	off_t end = offset + size;
+
+	fflush(stdout);
+	while (offset < end) {
+		ssize_t sent = sendfile(to, from, &offset, end - offset);
+
+		if (sent < 0 && errno == EINTR) {
+			continue;
+		}
+		if (sent <= 0) {
+			break;
+		}
+	}
+
+	// Where sendfile cannot write (stdout opened for appending), copy the rest.
+	char buffer[MOVE_CHUNK];
+	while (offset < end) {
+		ssize_t got = pread(from, buffer, end - offset < MOVE_CHUNK ? end - offset : MOVE_CHUNK, offset);
+
+		if (got <= 0 || !writeAll(to, buffer, got)) {
+			break;
+		}
+		offset += got;
+	}
+}
+
+
+/*
+ * moveBlock(to, block) -- Appends everything in `block` to `to` with `sendRange` and
+ * empties `block`. Returns `block`, or `-1` if it had to be closed.
+ */
+static int moveBlock(int to, int block) {
+
+	sendRange(to, block, 0, lseek(block, 0, SEEK_CUR));
+
+	if (ftruncate(block, 0) != 0 || lseek(block, 0, SEEK_SET) != 0) {
+		close(block);
+		return -1;
+	}
+	return block;
+}
+
+
+/*
+ * capturePipe(slot) -- Called before a line of the recipe built in `slot` is started.
+ * Returns the descriptor the line should use as its stdout and stderr, or `-1` if output
+ * is not captured (or cannot be), in which case the line writes to the terminal. When
+ * streaming and no target is in the foreground, this one takes it, after printing what
+ * it has so far.
+ */
+int capturePipe(int slot) {
+
+	struct slotOutput *output = capturing ? &outputs[slot] : NULL;
+	int ends[2];
+
+	if (output == NULL) {
+		return -1;
+	}
+	if (output->seq < 0) {
+		output->seq = nextSeq++;
+	}
+	if (output->block < 0) {
+		output->block = openBlock();
+	}
+	if (output->block < 0 || pipe2(ends, O_CLOEXEC) != 0) {
+		return -1;
+	}
+	if (streamOutput && foreground < 0) {
+		output->block = moveBlock(STDOUT_FILENO, output->block);
+		foreground = slot;
+	}
+	fcntl(ends[0], F_SETFL, O_NONBLOCK);
+	output->pipe = ends[0];
+	return ends[1];
+}
+
+
+/*
+ * captureStarted(slot, pid, writeEnd) -- Called once the line for `slot` was started as
+ * process `pid` (`-1` if it could not be) with `writeEnd` from `capturePipe` as its output.
+ * Closes the parent's copy of `writeEnd` and opens a pidfd for the process if the kernel
+ * has them; without one, `waitChild` polls for the exit instead.
+ */
+void captureStarted(int slot, pid_t pid, int writeEnd) {
+
+	if (writeEnd < 0) {
+		return;
+	}
+	close(writeEnd);
+
+	struct slotOutput *output = &outputs[slot];
+
+	output->pid = pid;
+	output->pidfd = -1;
+#ifdef SYS_pidfd_open
+	if (pid > 0) {
+		output->pidfd = syscall(SYS_pidfd_open, pid, 0);
+	}
+#endif
+}
+
+
+/*
+ * drainPipe(slot) -- Moves everything waiting in the pipe of `slot`: to stdout if it is
+ * in the foreground, otherwise to the end of its block, with `splice` where the kernel
+ * can and through a buffer where it cannot. Closes the pipe once its writers have all
+ * closed it. Only waits for stdout, never for the pipe.
+ */
+static void drainPipe(int slot) {
+
+	struct slotOutput *output = &outputs[slot];
+	char buffer[MOVE_CHUNK];
+
+	while (output->pipe >= 0) {
+		ssize_t moved = -1;
+
+		errno = EINVAL;
+		if (slot != foreground) {
+			moved = splice(output->pipe, NULL, output->block, NULL, MOVE_CHUNK, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		}
+		if (moved < 0 && errno == EINVAL) {
+			int to = slot == foreground ? STDOUT_FILENO : output->block;
+
+			moved = read(output->pipe, buffer, sizeof(buffer));
+			if (moved > 0 && !writeAll(to, buffer, moved)) {
+				perror(slot == foreground ? "stdout" : "output block");
+			}
+		}
+		if (moved > 0) {
+			continue;
+		}
+		if (moved < 0 && (errno == EAGAIN || errno == EINTR)) {
+			return;
+		}
+		close(output->pipe);
+		output->pipe = -1;
+	}
+}
+
+
+/*
+ * endLine(slot) -- Takes the last of the output of the line in `slot`, which exited, and
+ * closes its pipe and pidfd. Anything still holding the pipe, like a process the line
+ * started in the background, cannot add to the output after this.
+ */
+static void endLine(int slot) {
+
+	struct slotOutput *output = &outputs[slot];
+
+	drainPipe(slot);
+	if (output->pipe >= 0) {
+		close(output->pipe);
+		output->pipe = -1;
+	}
+	if (output->pidfd >= 0) {
+		close(output->pidfd);
+		output->pidfd = -1;
+	}
+	output->pid = -1;
+}
+
+
+/*
+ * waitChild(status, timeout) -- Waits for a recipe process to exit like `waitpid(-1,
+ * status, 0)` and returns its pid, or `0` if none exited within `timeout` milliseconds
+ * (`-1` waits as long as it takes). While output is captured, the pipes of all running
+ * lines are drained in the meantime, so none of them blocks on a full pipe, and the rest
+ * of the exited line's output is in its block before this returns.
+ */
+pid_t waitChild(int *status, int timeout) {
+
+	struct timespec start;
+	pid_t pid;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (!capturing && timeout < 0) {
+		return waitpid(-1, status, 0);
+	}
+	if (!capturing) {
+		while ((pid = waitpid(-1, status, WNOHANG)) == 0 && elapsedNanos(&start) < timeout * 1e6) {
+			struct timespec pause = {0, 10 * 1000000L};
+
+			nanosleep(&pause, NULL);
+		}
+		return pid;
+	}
+
+	struct pollfd *fds = malloc(2 * outputCount * sizeof(struct pollfd));
+	int *owners = malloc(2 * outputCount * sizeof(int));
+
+	if (fds == NULL || owners == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+
+	while ((pid = waitpid(-1, status, WNOHANG)) == 0) {
+		int count = 0;
+		int wait = -1;
+		int slot;
+
+		if (timeout >= 0) {
+			wait = timeout - (int)(elapsedNanos(&start) / 1e6);
+			if (wait <= 0) {
+				break;
+			}
+		}
+
+		for (slot = 0; slot < outputCount; slot++) {
+			if (outputs[slot].pipe >= 0) {
+				fds[count].fd = outputs[slot].pipe;
+				fds[count].events = POLLIN;
+				owners[count++] = slot;
+			}
+			if (outputs[slot].pidfd >= 0) {
+				fds[count].fd = outputs[slot].pidfd;
+				fds[count].events = POLLIN;
+				owners[count++] = -1;
+			} else if (outputs[slot].pid > 0 && (wait < 0 || wait > 10)) {
+				// No pidfd to wake on, so check for the exit now and then.
+				wait = 10;
+			}
+		}
+		if (count == 0 && wait < 0) {
+			pid = waitpid(-1, status, 0);
+			break;
+		}
+
+		if (poll(fds, count, wait) < 0 && errno != EINTR) {
+			perror("poll");
+			freeLL();
+			exit(1);
+		}
+		int index;
+		for (index = 0; index < count; index++) {
+			if (owners[index] >= 0 && fds[index].revents != 0) {
+				drainPipe(owners[index]);
+			}
+		}
+	}
+
+	int slot;
+	for (slot = 0; slot < outputCount && pid > 0; slot++) {
+		if (outputs[slot].pid == pid) {
+			endLine(slot);
+		}
+	}
+	free(fds);
+	free(owners);
+	return pid;
+}
+
+
+/*
+ * captureText(slot, text) -- Prints `text` and a newline as part of the output of the
+ * target built in `slot`: straight to stdout if it is in the foreground or output is not
+ * captured, otherwise into its block.
+ */
+void captureText(int slot, const char *text) {
+
+	if (!capturing || slot == foreground || outputs[slot].block < 0) {
+		printf("%s\n", text);
+		if (capturing) {
+			fflush(stdout);
+		}
+		return;
+	}
+
+	size_t len = strlen(text);
+	if (!writeAll(outputs[slot].block, text, len) || !writeAll(outputs[slot].block, "\n", 1)) {
+		perror("output block");
+	}
+}
+
+
+/*
+ * oldestRunning() -- Returns the lowest `seq` of the targets still being built, or
+ * `LONG_MAX` if there are none.
+ */
+static long oldestRunning() {
+
+	long oldest = LONG_MAX;
+	int slot;
+
+	for (slot = 0; slot < outputCount; slot++) {
+		if (outputs[slot].seq >= 0 && outputs[slot].seq < oldest) {
+			oldest = outputs[slot].seq;
+		}
+	}
+	return oldest;
+}
+
+
+/*
+ * queueBlock(slot) -- Ends the target built in `slot`. Its block is printed right away if
+ * no target started before it is still being built, and otherwise moved to the end of
+ * `doneBlock` to wait for them. Exits if memory allocation fails.
+ */
+static void queueBlock(int slot) {
+
+	struct slotOutput *output = &outputs[slot];
+	long seq = output->seq;
+
+	output->seq = -1;
+	if (output->block < 0) {
+		return;
+	}
+	if (seq < 0 || seq < oldestRunning()) {
+		output->block = moveBlock(STDOUT_FILENO, output->block);
+		return;
+	}
+
+	if (doneBlock < 0) {
+		doneBlock = openBlock();
+	}
+	if (doneBlock < 0) {
+		output->block = moveBlock(STDOUT_FILENO, output->block);
+		return;
+	}
+	if (doneCount == doneSize) {
+		doneSize = doneSize ? doneSize * 2 : 16;
+		doneRanges = realloc(doneRanges, doneSize * sizeof(struct doneRange));
+
+		if (doneRanges == NULL) {
+			freeLL();
+			fprintf(stderr, "Ran Out of Memory.\n");
+			exit(1);
+		}
+	}
+
+	struct doneRange *range = &doneRanges[doneCount++];
+
+	range->seq = seq;
+	range->offset = lseek(doneBlock, 0, SEEK_CUR);
+	output->block = moveBlock(doneBlock, output->block);
+	range->size = lseek(doneBlock, 0, SEEK_CUR) - range->offset;
+}
+
+
+/*
+ * printDone() -- Prints, in the order their targets started, the waiting blocks whose
+ * targets started before every target still being built, and empties `doneBlock` once
+ * none are left.
+ */
+static void printDone() {
+
+	long oldest = oldestRunning();
+
+	while (doneCount > 0) {
+		int next = 0;
+		int index;
+
+		for (index = 1; index < doneCount; index++) {
+			if (doneRanges[index].seq < doneRanges[next].seq) {
+				next = index;
+			}
+		}
+		if (doneRanges[next].seq > oldest) {
+			return;
+		}
+		sendRange(STDOUT_FILENO, doneBlock, doneRanges[next].offset, doneRanges[next].size);
+		doneRanges[next] = doneRanges[--doneCount];
+	}
+
+	if (doneBlock >= 0 && (ftruncate(doneBlock, 0) != 0 || lseek(doneBlock, 0, SEEK_SET) != 0)) {
+		close(doneBlock);
+		doneBlock = -1;
+	}
+}
+
+
+/*
+ * flushCapture(slot) -- Called when the target built in `slot` is done, whether it
+ * succeeded or not. Its block is printed once every target started before it has been
+ * printed (see `queueBlock`). When streaming, it is printed now instead, unless another
+ * target is in the foreground, in which case the block waits behind that one's output.
+ * If it was the foreground target, the blocks that waited are printed after it and a
+ * target still running takes the foreground, starting with what it has so far.
+ */
+void flushCapture(int slot) {
+
+	if (!capturing) {
+		return;
+	}
+	if (!streamOutput) {
+		queueBlock(slot);
+		printDone();
+		return;
+	}
+	if (foreground >= 0 && foreground != slot) {
+		if (outputs[slot].block >= 0) {
+			if (doneBlock < 0) {
+				doneBlock = openBlock();
+			}
+			outputs[slot].block = moveBlock(doneBlock >= 0 ? doneBlock : STDOUT_FILENO, outputs[slot].block);
+		}
+		return;
+	}
+
+	if (outputs[slot].block >= 0) {
+		outputs[slot].block = moveBlock(STDOUT_FILENO, outputs[slot].block);
+	}
+	foreground = -1;
+	if (doneBlock >= 0) {
+		doneBlock = moveBlock(STDOUT_FILENO, doneBlock);
+	}
+
+	int next;
+	for (next = 0; next < outputCount; next++) {
+		if (outputs[next].pid > 0) {
+			if (outputs[next].block >= 0) {
+				outputs[next].block = moveBlock(STDOUT_FILENO, outputs[next].block);
+			}
+			foreground = next;
+			return;
+		}
+	}
+}
+
+
+/*
+ * closeCapture() -- Prints what is left in every block and closes them all.
+ */
+void closeCapture() {
+
+	int slot;
+
+	for (slot = 0; slot < outputCount; slot++) {
+		endLine(slot);
+		flushCapture(slot);
+	}
+	for (slot = 0; slot < outputCount; slot++) {
+		if (outputs[slot].block >= 0) {
+			close(outputs[slot].block);
+		}
+	}
+	if (doneBlock >= 0) {
+		close(doneBlock);
+	}
+	free(outputs);
+	free(doneRanges);
+	outputs = NULL;
+	doneRanges = NULL;
+	doneCount = 0;
+	doneSize = 0;
+	outputCount = 0;
+	capturing = 0;
+	foreground = -1;
+	doneBlock = -1;
+}
@@ -10,6 +10,7 @@
 
 
 # include "header.h"
+# include <sys/mman.h>
 
 
 
@@ -22,251 +23,189 @@ void addNodeToGraph(struct parentNode *node);
 struct parentNode *headLL = NULL;
 char *targetNode = NULL;
 char *curLine = NULL;
+int useMmap = 1;
+int graphSize = 0;
+
+// The rule being parsed and its commands so far.
+static struct parentNode *temp = NULL;
+static struct LineNode *CMDS = NULL;
+static struct LineNode **cmdsTail = &CMDS;
 
 /*
  * addParentNode(node) -- Adds a new parent node to the linked list (`headLL`).
- * Takes a pointer to a `struct parentNode` and appends it to the end of the list.
- * Assumes that `node` is properly allocated and initialized. If `headLL` is empty,
- * sets `headLL` to the new node.
+ * Takes a pointer to a `struct parentNode` and appends it to the end of the list
+ * through `tailLL`, gives it the next node id and its slot in the graph arrays,
+ * and indexes it in the target table.
+ * Assumes that `node` is properly allocated and initialized, including `nameHash`.
+ * If `headLL` is empty, sets `headLL` to the new node.
  */
 void addParentNode(struct parentNode *node) {
 
+	node->id = graphSize++;
+	graphAddNode(node);
+	tableInsert(node);
+
 	if (headLL == NULL) {
 		headLL = node;
-		if (targetNode == NULL) {
-                        targetNode = node->name;
-                }
+		tailLL = node;
 		return;
 	}
 
-	struct parentNode *cur = headLL;
+	tailLL->next = node;
+	tailLL = node;
+}
 
-	while (cur->next != NULL) {
-	
-		cur = cur->next;
-	}
-	cur->next = node;
+
+/*
+ * newParentNode(name, len) -- Allocates and initializes a `struct parentNode` in the arena.
+ * Takes the first `len` bytes of `name`, which are copied into the arena once.
+ * The node has no commands; its flags and edges start empty once it is added.
+ */
+struct parentNode *newParentNode(const char *name, size_t len) {
+
+	struct parentNode *node = arenaZalloc(sizeof(struct parentNode));
+
+	node->name = arenaStrndup(name, len);
+	node->nameHash = hashName(name, len);
+	return node;
 }
 
 
 /*
- * addChildNode(parent, child) -- Links a child node to a given parent node.
- * Takes a pointer to a `struct parentNode` (`parent`) and another `struct parentNode` (`child`).
- * Allocates a new `struct childNode` and adds it to the parent's `children` list.
- * Assumes that `parent` and `child` are valid pointers. Prevents duplicate children.
+ * internNode(name, len) -- Returns the node named by the first `len` bytes of `name`.
+ * Creates the node (as a non-target) and adds it to the graph if it is not there yet.
  */
-void addChildNode(struct parentNode *parent, struct parentNode *child) {
+struct parentNode *internNode(const char *name, size_t len) {
 
-	struct childNode *cur = parent->children;
+	struct parentNode *node = tableFind(name, len);
 
-	struct childNode *newChild = malloc(sizeof(struct childNode));
-	
-	if (newChild == NULL) {
-		fprintf(stderr, "Ran Out of Memory.\n");
-		exit(1);
+	// CREATE NODE AND ADD TO LL
+	if (node == NULL) {
+		node = newParentNode(name, len);
+		addParentNode(node);
 	}
-	
-	newChild->to = child;
-	newChild->next = NULL;
+	return node;
+}
 
-	if (cur == NULL) {
-		parent->children = newChild;
-		return;
+
+/*
+ * startRule(name, len) -- Returns the node for a rule whose target is the first `len` bytes of `name`.
+ * Creates the node if needed and marks it as a target. The target of the first rule
+ * becomes the default goal (`targetNode`).
+ *
+ * Error Handling:
+ * - Exits if a rule with prerequisites for the same target was already parsed.
+ */
+struct parentNode *startRule(const char *name, size_t len) {
+
+	struct parentNode *actionHead = tableFind(name, len);
+
+	// OG Action has already been initialized.
+	if (actionHead != NULL && graphChildCount(actionHead->id) != 0) {
+		// FREE MEMORY
+		freeLL();
+		fprintf(stderr, "Invalid Format. Node already exists.\n");
+		exit(1);
 	}
 
-	while (cur->next != NULL) {
+	// CREATE PARENT HEAD AND ADD TO LL.
+	// A node may already exist from an earlier rule's prerequisites.
+	if (actionHead == NULL) {
+		actionHead = newParentNode(name, len);
 
-		if (cur->to == child) {
-			return;
-		}
-		cur = cur->next;
+		// ADD NEW NODE.
+		addParentNode(actionHead);
 	}
-	if (cur->to != child) {
-		cur->next = newChild;
+	graph.flags[actionHead->id].target = 1;
+	if (targetNode == NULL) {
+		targetNode = actionHead->name;
 	}
+	return actionHead;
 }
 
 
-
 /*
  * findParentNode(name) -- Searches for a parent node with the given name.
  * Takes a string (`char *name`) and returns a pointer to the `struct parentNode`
- * if found in the linked list. If the node does not exist, returns `NULL`.
- * Assumes `headLL` is properly initialized.
+ * if it is in the target table. If the node does not exist, returns `NULL`.
  */
 struct parentNode* findParentNode(char *name) {
 
-	struct parentNode *cur = headLL;
-
-        while (cur != NULL) {
-                if (strcmp(cur->name, name) == 0) {
-                        // Found node.
-			return cur;
-                }
-                cur = cur->next;
-        }
-	// No node yet created.
-	return NULL;
-}
-
-/*
- * searchHeadActionForDup(name) -- Checks if a parent node with a given name has children.
- * Takes a string (`char *name`) and returns `1` if the node exists and has children,
- * otherwise returns `0`. If no matching node is found in `headLL`, returns `0`.
- * Assumes that `headLL` is properly initialized.
- */
-int searchHeadActionForDup(char *name) {
-
-	struct parentNode *cur = headLL;
-
-	while (cur != NULL) {
-		if (strcmp(cur->name, name) == 0) {
-			if (cur->children != NULL) {
-				return 1;
-			}
-			return 0;
-		}
-		cur = cur->next;
-	}
-	return 0;
+	return tableFind(name, strlen(name));
 }
 
 
 /*
- * useActionLineAndAddNodes(line) -- Parses a makefile-style action line and adds nodes to the dependency graph.
- * Takes a string (`char *line`) representing a target and its dependencies, then:
- * - Extracts the target and dependencies using `sscanf`.
- * - Ensures the target is unique (no duplicate entries).
- * - Creates the `parentNode` if it does not exist.
+ * useActionLineAndAddNodes(line, eol) -- Parses a makefile-style action line and adds nodes to the dependency graph.
+ * Takes the characters of the line from `line` up to (not including) `eol`, then:
+ * - Checks that the line has exactly one colon (`:`).
+ * - Takes the first word before the colon as the target and every whitespace-separated
+ *   word after it as a dependency. Words are (pointer, length) slices of the line, so
+ *   names of any length are handled without copying them or allocating per word.
+ * - Ensures the target is unique (no duplicate entries) and creates its `parentNode`.
  * - Adds dependencies as child nodes.
- * Returns a pointer to the `struct parentNode` representing the target.
- *
- * Assumptions:
- * - `line` is a valid string formatted as `target : dependencies` with exactly one colon (`:`).
- * - The memory for new nodes must be allocated dynamically.
- * - Dependencies are space-separated and can be empty.
- * - Assumes `headLL` is properly initialized before calling.
+ * A `.PHONY` or `.RESTAT` line is not a rule: each word after its colon is marked
+ * phony or restat instead. Returns a pointer to the `struct parentNode` representing
+ * the target, or `NULL` for a `.PHONY` or `.RESTAT` line.
  *
  * Error Handling:
- * - Exits if memory allocation fails.
- * - Exits if the format is invalid (too many or too few components).
+ * - Exits if there is no colon or more than one.
+ * - Exits if there is no target before the colon.
  * - Exits if the target node already exists.
  */
-struct parentNode* useActionLineAndAddNodes(char* line) {
+struct parentNode* useActionLineAndAddNodes(char *line, char *eol) {
 
-	char *tempPointers = calloc((strlen(line) + 1), (sizeof(char)));//?
-	
-	if (tempPointers == NULL) {
+	char *colon = memchr(line, ':', eol - line);
+
+	// Either no colons were found or command was not tabbed.
+	if (colon == NULL || memchr(colon + 1, ':', eol - colon - 1) != NULL) {
+		//FREE MEMORY (freeLL also frees the current line)
 		freeLL();
-		fprintf(stderr, "Ran Out of Memory.\n");
+		fprintf(stderr, "Invalid Format, either no or one too many Colons.\n");
 		exit(1);
 	}
-	
-	char tempTarget[65];
-	int retVal = sscanf(line, "%s : %[^\n]", tempTarget, tempPointers);
 
-	if (retVal  > 2 || (retVal < 1)) {
-		free(tempPointers);
-		// FREE MEMORY
+	char *cur = line;
+	while (cur < colon && isspace(*cur)) {
+		cur++;
+	}
+	char *word = cur;
+	while (cur < colon && !isspace(*cur)) {
+		cur++;
+	}
+	if (cur == word) {
 		freeLL();
 		fprintf(stderr, "Invalid Format.\n");
 		exit(1);
 	}
 
-	char *restPointers = strdup(tempPointers);
-	char *target = strdup(tempTarget);
-		
-	free(tempPointers);
-
-	// OG Action has already been initialized.
-	if (searchHeadActionForDup(target) == 1) {
-		// FREE MEMORY
-		freeLL();
-		fprintf(stderr, "Invalid Format. Node already exists.\n");
-		exit(1);
-	}	
+	int phony = cur - word == 6 && memcmp(word, ".PHONY", 6) == 0;
+	int restat = cur - word == 7 && memcmp(word, ".RESTAT", 7) == 0;
+	struct parentNode *actionHead = phony || restat ? NULL : startRule(word, cur - word);
 
-	struct parentNode *actionHead = findParentNode(target);
-
-	// CREATE PARENT HEAD AND ADD TO LL.
-	if (actionHead == NULL) {
-		actionHead = malloc(sizeof(struct parentNode));
-		
-		if (actionHead == NULL) {
-			freeLL();
-			fprintf(stderr, "Ran Out of Memory.\n");
-                	exit(1);
+	cur = colon + 1;
+	while (cur < eol) {
+		while (cur < eol && isspace(*cur)) {
+			cur++;
 		}
-		
-		actionHead->name = strdup(target);
-		actionHead->cmds = NULL;
-		actionHead->children = NULL;
-		actionHead->next = NULL;
-		actionHead->visited = 0;
-		actionHead->doesExist = 0;
-		actionHead->mustBuild = 0;
-		actionHead->completed = 0;
-		actionHead->fileDate = (time_t)-1;
-		actionHead->target = 1;
-
-		// ADD NEW NODE.
-		addParentNode(actionHead);
-	}
-
-
-	free(target);
-
-	char *tempPointer = malloc((strlen(restPointers) + 1) * sizeof(char)); 
-
-	if (tempPointer == NULL) {
-		// FREE MEMORY
-        	freeLL();
-		fprintf(stderr, "Ran Out of Memory.\n");
-                exit(1);
-        }
-	int retval;
-	char* restSave = restPointers;
-	while ((retval = sscanf(restPointers, "%s", tempPointer)) == 1) {
-	
-		struct parentNode *action = findParentNode(tempPointer);
-
-		// CREATE NODE AND ADD TO LL
-		if (action == NULL) {
-			action = malloc(sizeof(struct parentNode));
-			action->name = strdup(tempPointer);
-                	action->cmds = NULL;
-                	action->children = NULL;
-                	action->next = NULL;
-                	action->visited = 0;
-			action->doesExist = 0;
-			action->mustBuild = 0;
-			action->completed = 0;
-			action->fileDate = (time_t)-1;
-			action->target = 0;
-			addParentNode(action);
+		word = cur;
+		while (cur < eol && !isspace(*cur)) {
+			cur++;
 		}
-		// ADD TO HEAD CHILDREN.
-		addChildNode(actionHead, action);
-
-		restPointers += strlen(tempPointer);
-
-		while (isspace(*restPointers)) {
-    			restPointers++;
+		if (cur > word && (phony || restat)) {
+			// Interning may grow the graph arrays, so it comes first.
+			int id = internNode(word, cur - word)->id;
+
+			if (phony) {
+				graph.flags[id].phony = 1;
+			} else {
+				graph.flags[id].restat = 1;
+			}
+		} else if (cur > word) {
+			// ADD TO HEAD CHILDREN.
+			graphAddEdge(actionHead->id, internNode(word, cur - word)->id);
 		}
-
-		free(tempPointer);
-		tempPointer = malloc((strlen(restPointers) + 1) * sizeof(char));
-		if (tempPointer == NULL) {
-			// FREE MEMORY
-			free(restPointers);
-			freeLL();
-                	fprintf(stderr, "Ran Out of Memory.\n");
-                	exit(1);
-        	}
 	}
-
-	free(restSave);
-	free(tempPointer);
 	return actionHead;
 }
 
@@ -292,13 +231,11 @@ void printLL() {
 
 		printf("CUR PARENT: %s\n", curP->name);
 
-		struct childNode *curC = curP->children;
+		int edge;
 
-		while (curC != NULL) {
+		for (edge = graph.childStart[curP->id]; edge < graph.childStart[curP->id + 1]; edge++) {
 
-			printf("	CUR CHILD: %s\n", curC->to->name);
-
-			curC = curC->next;
+			printf("	CUR CHILD: %s\n", graph.nodes[graph.childIds[edge]]->name);
 		}
 		
 		struct LineNode *curCM = curP->cmds;
@@ -313,128 +250,199 @@ void printLL() {
 
 
 /*
- * addLine(head, newLine) -- Adds a new line entry to a command linked list.
- * Takes a pointer to a linked list (`struct LineNode **head`) and a new command (`char *newLine`).
- * Allocates memory for a new node, stores the command, and appends the node to the list.
- * Assumes `head` is a pointer to a valid linked list or is `NULL` (empty list).
- * Exits if memory allocation fails.
+ * addLine(tail, newLine, len) -- Adds a new line entry to a command linked list.
+ * Takes a pointer to the `next` field of the last node of the list (`struct LineNode **tail`)
+ * and the first `len` bytes of a new command (`char *newLine`). Allocates the node and a
+ * copy of the command in the arena, appends the node and moves `*tail` to its `next` field.
  */
-void addLine(struct LineNode **head, char *newLine) {
+void addLine(struct LineNode ***tail, const char *newLine, size_t len) {
 
-	struct LineNode *newNode = malloc(sizeof(struct LineNode));
+	struct LineNode *newNode = arenaAlloc(sizeof(struct LineNode));
 
-	if (newNode == NULL) {
-		freeLL();
-		fprintf(stderr, "Ran Out Of Memory.\n");
-		exit(1);
+	newNode->line = arenaStrndup(newLine, len);  // Store a copy of the line
+	newNode->next = NULL;
+
+	**tail = newNode;
+	*tail = &newNode->next;
+}
+
+/*
+ * parseLine(line, eol) -- Adds one line of a makefile, from `line` up to `eol`, to the graph.
+ * Command lines (starting with a tab) are appended to the commands of the current rule;
+ * any other non-blank line starts a new rule. Commands after a `.PHONY` or `.RESTAT`
+ * line are ignored. Shared by both parsers.
+ *
+ * Error Handling:
+ * - Exits if a command comes before the first rule.
+ * - Exits if a rule line is invalid (see `useActionLineAndAddNodes`).
+ */
+void parseLine(char *line, char *eol) {
+
+	// IS CMDS
+	if (line < eol && *line == '\t') {
+
+		if (headLL == NULL) {
+			fprintf(stderr, "Invalid Format. Commands Cannot be First.\n");
+			freeLL();
+			exit(1);
+		}
+
+		char *noSpace = line;
+		while (noSpace < eol && isspace(*noSpace)) {
+			noSpace++;
+		}
+		if (noSpace < eol) {
+			addLine(&cmdsTail, noSpace, eol - noSpace);
+		}
+		return;
 	}
 
-	newNode->line = strdup(newLine);  // Store a copy of the line
-    	newNode->next = NULL;
+	// IS TARGETS
+	char *cur = line;
+	while (cur < eol && isspace(*cur)) {
+		cur++;
+	}
 
-	if (*head == NULL) {
-		*head = newNode;
+	// Empty line, nothing to add.
+	if (cur == eol) {
 		return;
 	}
 
-	struct LineNode *cur = *head;
-        while (cur->next != NULL) {
-            	cur = cur->next;
-        }
-        cur->next = newNode;
+	// ADD CMDS TO TEMP
+	if (temp != NULL) {
+		temp->cmds = CMDS;
+	}
 
+	// MAKE TEMP THIS
+	temp = useActionLineAndAddNodes(line, eol);
+	CMDS = NULL;
+	cmdsTail = &CMDS;
 }
 
+
 /*
- * countColons(line) -- Counts the number of colons (`:`) in a given string.
- * Takes a string (`char *line`) and returns the count of colons.
- * Assumes `line` is a valid null-terminated string.
+ * parseRule(line, end) -- Parses the rule whose rule line starts at `line`, together
+ * with the command and blank lines after it, in a mapped makefile that ends at `end`.
+ * The commands are handed to the rule the same way a whole-file parse would. Used by
+ * the lazy parser, which parses one rule at a time. Returns where the next rule line starts.
+ *
+ * Error Handling:
+ * - Exits if the rule line is invalid (see `useActionLineAndAddNodes`).
  */
-int countColons(char *line) {
-	int colons = 0;
+char *parseRule(char *line, char *end) {
+
+	char *eol = memchr(line, '\n', end - line);
+	char *pos = eol ? eol + 1 : end;
 
-	while (*line != 0) {
-		if (*line == ':') {
-			colons++;
+	parseLine(line, eol ? eol : end);
+
+	while (pos < end) {
+		eol = memchr(pos, '\n', end - pos);
+		if (eol == NULL) {
+			eol = end;
 		}
-		line++;
+
+		char *cur = pos;
+		while (cur < eol && isspace(*cur)) {
+			cur++;
+		}
+		// The next rule line ends this rule.
+		if (*pos != '\t' && cur < eol) {
+			break;
+		}
+		parseLine(pos, eol);
+		pos = eol < end ? eol + 1 : end;
+	}
+
+	// As in a whole-file parse, a rule without commands clears those of an earlier
+	// rule for the same target, unless it is the last rule of the file.
+	if (temp != NULL && (CMDS != NULL || pos < end)) {
+		temp->cmds = CMDS;
 	}
-	return colons;
+	temp = NULL;
+	CMDS = NULL;
+	cmdsTail = &CMDS;
+	return pos;
 }
 
+
 /*
- * fixLine(oldLine) -- Cleans and formats a makefile dependency line.
- * Takes a string (`char *oldLine`) and returns a new formatted string:
- * - Removes leading and trailing whitespace.
- * - Adds a space before or after colons (`:`) to ensure proper parsing.
- * - Eliminates consecutive spaces.
- * The returned string is dynamically allocated, so it must be freed by the caller.
- * Assumes `oldLine` is a valid null-terminated string.
+ * finishParse() -- Hands the commands collected since the last rule line to that
+ * rule, freezes the graph into its compact form and resets the parser state for
+ * the next makefile.
  */
-char* fixLine(char *oldLine) {
-	char *newLine = calloc((strlen(oldLine) + 3), sizeof(char));
+void finishParse() {
 
-	if (newLine == NULL) {
+	if (CMDS != NULL && temp != NULL) {
+		temp->cmds = CMDS;
+	}
+	temp = NULL;
+	CMDS = NULL;
+	cmdsTail = &CMDS;
+	freezeGraph();
+}
+
+
+/*
+ * parseMappedMakeFile(fd, size) -- Parses a makefile by memory-mapping it and tokenizing it in one pass.
+ * Takes an open file descriptor (`fd`) of a regular file and its size. Lines are never
+ * copied: target and prerequisite names are looked up in place as (pointer, length)
+ * slices and only copied into the arena the first time they are seen, and recipe lines
+ * are copied straight into the arena.
+ *
+ * Returns:
+ * - `0` on successful parsing.
+ * - If errors are detected, it exits the program after printing an error message.
+ */
+int parseMappedMakeFile(int fd, off_t size) {
+
+	if (size == 0) {
+		finishParse();
+		return 0;
+	}
+
+	char *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		perror("mmap");
 		freeLL();
-		fprintf(stderr, "Ran Out of Mem.\n");
 		exit(1);
 	}
+	madvise(data, size, MADV_SEQUENTIAL);
 
-	int index = 0;
-	int newIndex = 0;
-	while (oldLine[index] != 0) {
+	char *end = data + size;
+	char *pos = data;
 
-		// gets rid of leading whitespace
-		if (newIndex == 0) {
-			while (isspace(oldLine[index])) {
-					index++;
-			}
-		}
-
-		// trailing spaces
-		while (isspace(oldLine[index]) && isspace(oldLine[index + 1])) {
-			index++;
-		}
+	while (pos < end) {
 
-		// adds space either before or after ':'
-		if (oldLine[index + 1] == ':') {
-			newLine[newIndex] = oldLine[index];
-			newLine[newIndex + 1] = ' ';
-			newIndex += 2;
-		} else if (oldLine[index] == ':' && !isspace(oldLine[index + 1])) {
-			newLine[newIndex] = oldLine[index];
-			newLine[newIndex + 1] = ' ';
-			newIndex += 2;
-		} else {
-			newLine[newIndex] = oldLine[index];
-			newIndex++;
+		char *eol = memchr(pos, '\n', end - pos);
+		if (eol == NULL) {
+			eol = end;
 		}
-		index++;
+		parseLine(pos, eol);
+		pos = eol + 1;
 	}
-	newLine[newIndex] = 0;
-	char *cpy = strdup(newLine);
-	free(newLine);
-	return cpy;
+	finishParse();
+	munmap(data, size);
+	return 0;
 }
 
 
-
 /*
  * parseMakeFileData(fp) -- Parses a makefile-style input file and constructs a dependency graph.
- * Takes a file pointer (`FILE *fp`) and processes each line:
- * - Identifies command lines (starting with whitespace) and adds them to the linked list.
+ * Regular files are handed to `parseMappedMakeFile` unless `useMmap` is off; anything else
+ * (pipes, terminals) is read with `getline`, which grows its buffer to fit lines of any length.
+ * Takes a file pointer (`FILE *fp`) and processes each line with `parseLine`:
+ * - Identifies command lines (starting with a tab) and adds them to the current rule.
  * - Parses target dependency lines, ensuring the format is valid.
  * - Creates and links parent and child nodes dynamically based on dependencies.
  *
  * Assumptions:
  * - `fp` is a valid open file pointer.
  * - Lines are properly formatted, with targets followed by a colon (`:`) and dependencies.
- * - The function properly tracks commands (`CMDS`) so they are linked to the correct nodes.
  *
  * Error Handling:
  * - Exits if format validation fails (missing or extra colons).
  * - Ensures proper memory management and frees allocated structures on failure.
- * - If memory allocation fails, calls `freeLL()` to clean up.
  *
  * Returns:
  * - `0` on successful parsing.
@@ -444,86 +452,22 @@ int parseMakeFileData(FILE *fp) {
 
 	char *line = NULL;
 	size_t size = 0;
+	ssize_t len;
 	int errSeen = 0;
-	struct LineNode *CMDS = NULL; 
-	
-	struct parentNode *temp = NULL;
-
-	while (getline(&line, &size, fp) > 0) {
-		
-		curLine = line;		
-		// IS CMDS
-		if (line[0] == '\t') {
-
-			if (headLL == NULL) {
-				fprintf(stderr, "Invalid Format. Commands Cannot be First.\n");
-				free(line);
-				exit(1);
-			}
-
-			// RESET CMDS so its unique to this action		
-			
-			char *noSpace = line;
-
-			while(isspace(*noSpace)) {
-				noSpace++;
-			}
 
-			// MANUALLY REMOVE TRAILING NEWLINE
-			char *p = noSpace;
-			while (*p != '\0') {
-    				if (*p == '\n') {
-        				*p = '\0';
-        				break;
-    				}
-    				p++;
-			}
-			// CALL FUNCTION THAT WILL SEARCH IF NODE EXISTS ALREADY, IF NOT ADD NODE TO GRAPH, (FIRST CHECK IF HEAD ACTION IS A DUP) 
-			if (strlen(noSpace) > 0) {
-				addLine(&CMDS, noSpace);
-			}
-
-		// IS TARGETS
-		} else {
-
-			// Will make sure that the line isn't an empty line.
-			int tempIndex = 0;
-			while (isspace(line[tempIndex] && line[tempIndex] != 0)) {
-				tempIndex++;
-			}
-
-			// if it hit the end of the while loop, go to the next iteration (line).
-			if (line[tempIndex] == 0 || line[tempIndex] == '\n') {
-				continue;
-			}
-			// ADD CMDS TO TEMP
-			if (temp != NULL) {
-				temp->cmds = CMDS;
-			}
-
-			// Either no colons were found or command was not tabbed.
-			if (countColons(line) != 1) {
-				//FREE MEMORY
-				freeLL();
-				free(line);
-				fprintf(stderr, "Invalid Format, either no or one too many Colons.\n");
-				exit(1);
-			}
+	struct stat fileData;
+	if (useMmap && fstat(fileno(fp), &fileData) == 0 && S_ISREG(fileData.st_mode)) {
+		return parseMappedMakeFile(fileno(fp), fileData.st_size);
+	}
 
-			char *dupLine = strdup(line);        
-			char *fixedLine = fixLine(dupLine);   
+	while ((len = getline(&line, &size, fp)) > 0) {
 
-			free(dupLine);                       
+		curLine = line;
+		char *eol = memchr(line, '\n', len);
 
-			// MAKE TEMP THIS
-			temp = useActionLineAndAddNodes(fixedLine);
-			CMDS = NULL;
-			free(fixedLine);
-		}
-	}
-	if (CMDS != NULL) {
-		temp->cmds = CMDS;
+		parseLine(line, eol ? eol : line + len);
 	}
+	finishParse();
 	free(line);
 	curLine = NULL;
 	return errSeen;
@@ -10,191 +10,196 @@
 
 # include "header.h"
 
-int parseTargetFileData(char *fp); // return 1 if errSeen, 0 if not. If fatal error, exit program and return 1;
+int parseTargetFileData(char **names, int count); // return 1 if errSeen, 0 if not. If fatal error, exit program and return 1;
 void PostOrder(struct parentNode *node); // PRINT TREE IN POSTORDER (target from parseTargetFileData)
 struct parentNode *verifyTargetNode(char *name);
 int CMDSused = 0;
 
 
-/*
- * freeLines(head) -- Frees memory allocated for a linked list of command lines.
- * Takes a pointer to the head of a linked list (`struct LineNode *head`) and 
- * deallocates each node's memory. Assumes `head` points to a valid linked list 
- * structure or is NULL. This function does not modify `head` itself.
- */
-void freeLines(struct LineNode *head) {
-        struct LineNode *cur = head;
-        while (cur != NULL) {
-                struct LineNode *temp = cur;
-                cur = cur->next;
-                free(temp->line);
-                free(temp);
-        }
-}
-
 /*
  * freeLL() -- Frees memory allocated for the entire parent node linked list (`headLL`).
- * Iterates through all parent nodes, freeing child nodes and command lists as well.
- * Assumes `headLL` is a valid linked list structure or is NULL. This function cleans
- * up dynamically allocated memory associated with nodes and commands.
+ * Every node, command line and build record lives in the arena, so they are released
+ * with one `arenaFree()` call, and the graph arrays with `freeGraph()`. Also frees the
+ * line being parsed, if any, and resets the graph so another makefile can be parsed.
  */
 void freeLL() {
 
-	struct parentNode *curP = headLL;
-
-	while (curP != NULL) {
-
-		struct childNode *curC = curP->children;
-
-		while (curC != NULL) {
-
-			struct childNode *temp = curC;
-                	curC = curC->next;
-                	free(temp);
-		}
-		struct parentNode *temp = curP;
-		curP = curP->next;
-		freeLines(temp->cmds);
-		free(temp->name);
-		free(temp);
-		if (curLine != NULL) {
-			free(curLine);
-		}
+	arenaFree();
+	freeGraph();
+	releaseGraphCache();
+	if (curLine != NULL) {
+		free(curLine);
+		curLine = NULL;
 	}
+	headLL = NULL;
+	tailLL = NULL;
+	targetNode = NULL;
+	graphSize = 0;
+	partialGraph = 0;
+	tableFree();
 }
 
 /*
  * verifyTargetNode(name) -- Searches for a parent node with the given name.
  * Takes a string (`char *name`) and returns a pointer to the `struct parentNode`
- * that matches, or `NULL` if no match is found. Assumes `headLL` is properly 
- * initialized and `name` is a valid string.
+ * that matches, or `NULL` if no match is found. Uses the target table, so
+ * `name` must be a valid string.
  */
 struct parentNode *verifyTargetNode(char *name) {
 
-	struct parentNode *cur = headLL;
-
-	while (cur != NULL) {
-		if (strcmp(cur->name, name) == 0) {
-			return cur;
-		}
-		cur = cur->next;
-	}
-	return NULL;
+	return tableFind(name, strlen(name));
 }
 
 
 
 /*
- * praseCMDS(node) -- Executes the command list associated with a target node.
- * Iterates through `node->cmds`, printing each command before executing it with `system()`.
- * If a command fails (returns a nonzero exit status), prints an error, frees memory, and exits.
+ * struct potFrame -- One entry of the explicit traversal stack used by `POT`.
+ * Stores the id of the node being visited (`id`) and the index in `childIds`
+ * of the next edge to look at (`edge`).
  */
-void praseCMDS(struct parentNode *node) {
-
-	int result;
-	struct LineNode *cmdLine;
-        for (cmdLine = node->cmds; cmdLine != NULL; cmdLine = cmdLine->next) {
-                if (cmdLine->line[0] != 0) {
-			if ((result = system(cmdLine->line)) != 0) {
-				freeLL();
-				fprintf(stderr, "Invalid Command was Given.\n");
-				exit(1);
-			}
-			printf("%s\n",cmdLine->line);
-			CMDSused++;
-                }
-        }
-
-
-
-
-
-}
+struct potFrame {
+	int id;
+	int edge;
+};
 
+static struct potFrame *potStack = NULL;
+static int potDepth = 0;
+static int potSize = 0;
 
 
 /*
- * POT(node) -- Performs a post-order traversal on the dependency graph starting from `node`.
- * Checks if a target needs to be rebuilt based on file modification timestamps and dependencies.
- * If a cycle is detected, prints an error but continues execution.
- * Executes commands for the node if necessary, updating timestamps after execution.
- * Frees memory and exits if a critical error is encountered.
+ * enterNode(id) -- Marks node `id` as visited, stats it and pushes it on the traversal stack.
+ * A missing file that is not a target, or a missing target with no prerequisites,
+ * is a fatal error; any other missing target must be built. A phony target names
+ * no file, so it is never stat'ed and is always built.
  */
-void POT(struct parentNode *node) {
-	if (node->visited) {
-		return;
-	}
+void enterNode(int id) {
+
+	struct nodeFlags *flags = &graph.flags[id];
 
-	node->visited = 1;
+	flags->visited = 1;
 
-	struct stat fileData;
-	if (stat(node->name, &fileData) == 0) {
-		node->fileDate = fileData.st_mtime;
-		node->doesExist = 1; //both of these values set by calling stat()
-	} else {
-		if (!node->target) {
+	if (flags->phony) {
+		flags->mustBuild = 1;
+		traceDecision(id, "phony target", -1);
+	} else if (statNode(id) != 0) {
+		if (!flags->target) {
 			perror("stat");
 			freeLL();
 			exit(1);
 		} else {
-			node->mustBuild = 1;
+			flags->mustBuild = 1;
+			traceDecision(id, "target is missing", -1);
 		}
 	}
 
-	if (!node->doesExist) {
-		if (node->children == NULL) {
+	if (!flags->doesExist && !flags->phony) {
+		if (graphChildCount(id) == 0) {
 			fprintf(stderr, "Node Does not Exist.\n");
 			freeLL();
 			exit(1);
 		} else {
-			node->mustBuild = 1;
+			flags->mustBuild = 1;
 		}
 	}
 
-	struct childNode *childrenEdges;
-	for (childrenEdges = node->children; childrenEdges != NULL; childrenEdges = childrenEdges->next) {
-		POT(childrenEdges->to);
-		// CYCLE FOUND
-		if (childrenEdges->to->visited && (!childrenEdges->to->completed)) {
-			fprintf(stderr, "Cycle has been Found. This is a Acyclic Grpah.\n");
-			continue;
-		} else if (!node->mustBuild) {
-			if ((!childrenEdges->to->doesExist) || (childrenEdges->to->fileDate > node->fileDate)) {
-				node->mustBuild = 1;
-			}
+	if (potDepth == potSize) {
+		potSize = potSize ? potSize * 2 : 256;
+		potStack = realloc(potStack, potSize * sizeof(struct potFrame));
+
+		if (potStack == NULL) {
+			freeLL();
+			fprintf(stderr, "Ran Out of Memory.\n");
+			exit(1);
 		}
 	}
+	potStack[potDepth].id = id;
+	potStack[potDepth].edge = graph.childStart[id];
+	potDepth++;
+}
+
+
+/*
+ * printCycle(child) -- Prints the cycle closed by an edge from the node on top of
+ * the traversal stack back to node `child`, which is further down the stack, as
+ * `child -> ... -> top -> child`.
+ */
+void printCycle(int child) {
+
+	int index = potDepth - 1;
+	while (index > 0 && potStack[index].id != child) {
+		index--;
+	}
+
+	fprintf(stderr, "Cycle has been Found. This is a Acyclic Grpah: ");
+	for (; index < potDepth; index++) {
+		fprintf(stderr, "%s -> ", graph.nodes[potStack[index].id]->name);
+	}
+	fprintf(stderr, "%s\n", graph.nodes[child]->name);
+}
+
+
+/*
+ * POT(id) -- Performs a post-order traversal on the dependency graph starting from node `id`.
+ * Stats every reachable node and counts how many prerequisites each one waits on, then
+ * hands the node to the scheduler, which finds the nodes to release through the reverse
+ * edges. The traversal keeps its own stack on the heap instead of recursing, so chains
+ * of any depth are fine. If a cycle is detected, prints the whole cycle and drops the
+ * edge that closes it, but continues execution. Frees memory and exits if a critical
+ * error is encountered.
+ */
+void POT(int id) {
+	if (graph.flags[id].visited) {
+		return;
+	}
+
+	enterNode(id);
 
-	if (node->mustBuild) {
-		praseCMDS(node);
-        	if (stat(node->name, &fileData) == 0) {
-                	node->fileDate = fileData.st_mtime;
-                	node->doesExist = 1; //both of these values set by calling stat()
-        	} else {
-        		if (!node->target) {
-                        	perror("stat");
-                        	freeLL();
-                        	exit(1);
-			}
+	while (potDepth > 0) {
+		struct potFrame *frame = &potStack[potDepth - 1];
+
+		// All prerequisites done, so this node is too.
+		if (frame->edge == graph.childStart[frame->id + 1]) {
+			graph.flags[frame->id].completed = 1;
+			scheduleNode(frame->id);
+			potDepth--;
+			continue;
+		}
+
+		int child = graph.childIds[frame->edge];
+
+		if (!graph.flags[child].visited) {
+			// Come back to this edge once the child is complete.
+			enterNode(child);
+			continue;
 		}
 
+		// CYCLE FOUND
+		if (!graph.flags[child].completed) {
+			printCycle(child);
+			graph.dropped[frame->edge] = 1;
+		} else {
+			graph.pending[frame->id]++;
+		}
+		frame->edge++;
 	}
-	node->completed = 1;
+
+	free(potStack);
+	potStack = NULL;
+	potSize = 0;
 }
 
 
 /*
  * resetVisited() -- Resets the `visited` status of all parent nodes in the dependency graph.
- * Iterates through `headLL` and sets the `visited` field of each node to 0. It assumes that
- * headLL is either set to NULL or with a node.
+ * Clears the `visited` flag of every node id, so it works on an empty graph as well.
  */
 void resetVisited() {
 
-	struct parentNode *curP = headLL;
+	int id;
 
-	while (curP != NULL) {
-		curP->visited = 0;
-		curP = curP->next;
+	for (id = 0; id < graphSize; id++) {
+		graph.flags[id].visited = 0;
 	}
 }
 
@@ -202,29 +207,126 @@ void resetVisited() {
 
 
 /*
- * parseTargetFileData(fp) -- Parses a file representing a target node and executes its commands.
- * Takes a filename (`char *fp`), locates the corresponding parent node in `headLL`, and processes 
- * its dependencies using a post-order traversal. If the target is not found, prints an error 
- * and terminates the program. Frees memory after processing to avoid leaks.
+ * buildGoals(targets, count) -- Brings the `count` nodes in `targets` up to date in one
+ * build: loads the build database, stats every file below the targets in one batch,
+ * traverses the graph below every target with one shared visited state, so a
+ * prerequisite common to several targets is stat'ed and built once,
+ * runs the jobs (restoring what it can from the action cache) and saves the build
+ * database again, even if a command failed. Leaves the
+ * graph and its stat results in place for the caller. Returns `1` if a command failed
+ * and `0` otherwise.
  */
-int parseTargetFileData(char *fp) {
+int buildGoals(struct parentNode **targets, int count) {
+
+	struct timespec start;
+	int index;
 
-	struct parentNode *target = NULL;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	loadBuildDatabase();
+	loadHashCache();
+	openActionCache();
+	tracePhase("load build database", &start);
 
-	char *line = strdup(fp);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	prefetchStats(targets, count);
+	tracePhase("prefetch stats", &start);
 
-	target = verifyTargetNode(line);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (index = 0; index < count; index++) {
+		POT(targets[index]->id);
+	}
+	tracePhase("traverse", &start);
 
-	if (target == NULL) {
-		fprintf(stderr, "Target Was not Found and or Does not Exist.\n");
+	if (useHash) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		hashInputs();
+		tracePhase("hash inputs", &start);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int failed = runJobs();
+	tracePhase("run jobs", &start);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	saveBuildDatabase();
+	saveHashCache();
+	tracePhase("save build database", &start);
+	printStatStats();
+	printPrefetchStats();
+	printHashStats();
+	closeActionCache();
+	return failed;
+}
+
+
+/*
+ * findGoals(names, count) -- Returns a new array with the node of each of the `count`
+ * target names in `names`. Prints an error and returns `NULL` if one is not in the graph.
+ */
+struct parentNode **findGoals(char **names, int count) {
+
+	struct parentNode **targets = malloc(count * sizeof(struct parentNode *));
+	int index;
+
+	if (targets == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+
+	for (index = 0; index < count; index++) {
+		targets[index] = verifyTargetNode(names[index]);
+
+		if (targets[index] == NULL) {
+			fprintf(stderr, "Target Was not Found and or Does not Exist.\n");
+			free(targets);
+			return NULL;
+		}
+	}
+	return targets;
+}
+
+
+/*
+ * reportUpToDate(names, targets, count) -- Prints "name is up to date." for every goal
+ * that needed no work: all of them if no command ran, otherwise those that were not
+ * rebuilt themselves.
+ */
+void reportUpToDate(char **names, struct parentNode **targets, int count) {
+
+	int index;
+
+	for (index = 0; index < count; index++) {
+		if (!CMDSused || !graph.flags[targets[index]->id].mustBuild) {
+			printf("%s is up to date.\n", names[index]);
+		}
+	}
+}
+
+
+/*
+ * parseTargetFileData(names, count) -- Builds the `count` targets named in `names`.
+ * Locates each one in the graph and builds them all together with `buildGoals`. If a
+ * target is not found or a command fails, prints an error and terminates the program.
+ * Frees memory after processing to avoid leaks.
+ */
+int parseTargetFileData(char **names, int count) {
+
+	struct parentNode **targets = findGoals(names, count);
+
+	if (targets == NULL) {
+		freeLL();
+		exit(1);
+	}
+	if (buildGoals(targets, count)) {
+		free(targets);
+		freeLL();
+		fprintf(stderr, "Invalid Command was Given.\n");
 		exit(1);
 	}
-	POT(target);
+	reportUpToDate(names, targets, count);
 	resetVisited();
 	freeLL();
-	if (!CMDSused) {
-                printf("%s is up to date.\n", line);
-        }
-	free(line);
+	free(targets);
 	return 0;
 }
@@ -0,0 +1,386 @@
+/*
+* File: ruleIndex.c
+* Author: Chance Krueger
+* Purpose: Defines the lazy, goal-directed parser. A first pass over
+* the memory-mapped makefile only finds the rule lines and indexes
+* where each one starts by the name of its target, without copying
+* or allocating anything per name. Then only the rules reachable
+* from the goals are parsed, one target at a time as its node is
+* added to the graph, so building one small goal out of a large
+* makefile costs time in proportion to its part of the graph rather
+* than to the whole file.
+*/
+
+
+# include "header.h"
+# include <sys/mman.h>
+
+#define INDEX_START_SIZE 1024
+
+// Once the goals reach this fraction of the rules, a current graph cache is used instead.
+#define CACHE_FRACTION 8
+
+/*
+ * struct ruleLine -- One rule line found by the scan. Stores the target name as a
+ * slice of the mapped file (`name`, `len`) with its hash (`hash`), where the line
+ * starts (`line`), the next rule line for the same target in file order (`nextSame`,
+ * `-1` if none), the last one (`lastSame`, kept in the first line of each target only)
+ * and the first line of the next target in the same bucket (`hashNext`).
+ */
+struct ruleLine {
+	const char *name;
+	size_t len;
+	unsigned long hash;
+	char *line;
+	int nextSame;
+	int lastSame;
+	int hashNext;
+};
+
+// GLOBAL VARIBLES
+int useLazyParse = 1;
+int partialGraph = 0;
+
+static struct ruleLine *rules = NULL;
+static int ruleCount = 0;
+static int ruleSize = 0;
+static int *buckets = NULL;
+static int bucketCount = 0;
+static int nameCount = 0;
+
+
+/*
+ * resizeIndex(newCount) -- Moves the first rule line of every target into a new array
+ * of `newCount` buckets. Exits if memory allocation fails.
+ */
+static void resizeIndex(int newCount) {
+
+	int *newBuckets = malloc(newCount * sizeof(int));
+
+	if (newBuckets == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	memset(newBuckets, -1, newCount * sizeof(int));
+
+	int index;
+	for (index = 0; index < bucketCount; index++) {
+		int cur = buckets[index];
+
+		while (cur >= 0) {
+			int next = rules[cur].hashNext;
+			int slot = rules[cur].hash & (newCount - 1);
+
+			rules[cur].hashNext = newBuckets[slot];
+			newBuckets[slot] = cur;
+			cur = next;
+		}
+	}
+	free(buckets);
+	buckets = newBuckets;
+	bucketCount = newCount;
+}
+
+
+/*
+ * findRule(name, len, hash) -- Returns the index of the first rule line for the target
+ * named by the first `len` bytes of `name`, whose hash is `hash`, or `-1` if there is none.
+ */
+static int findRule(const char *name, size_t len, unsigned long hash) {
+
+	if (bucketCount == 0) {
+		return -1;
+	}
+
+	int cur = buckets[hash & (bucketCount - 1)];
+
+	while (cur >= 0) {
+		if (rules[cur].hash == hash && rules[cur].len == len && memcmp(rules[cur].name, name, len) == 0) {
+			return cur;
+		}
+		cur = rules[cur].hashNext;
+	}
+	return -1;
+}
+
+
+/*
+ * addRuleLine(name, len, line) -- Indexes the rule line starting at `line` under the
+ * target named by the first `len` bytes of `name`, after any earlier lines for it.
+ * Exits if memory allocation fails.
+ */
+static void addRuleLine(const char *name, size_t len, char *line) {
+
+	if (ruleCount == ruleSize) {
+		ruleSize = ruleSize ? ruleSize * 2 : INDEX_START_SIZE;
+		rules = realloc(rules, ruleSize * sizeof(struct ruleLine));
+
+		if (rules == NULL) {
+			freeLL();
+			fprintf(stderr, "Ran Out of Memory.\n");
+			exit(1);
+		}
+	}
+
+	unsigned long hash = hashName(name, len);
+	int first = findRule(name, len, hash);
+	struct ruleLine *rule = &rules[ruleCount];
+
+	rule->name = name;
+	rule->len = len;
+	rule->hash = hash;
+	rule->line = line;
+	rule->nextSame = -1;
+	rule->lastSame = ruleCount;
+	rule->hashNext = -1;
+
+	if (first >= 0) {
+		rules[rules[first].lastSame].nextSame = ruleCount;
+		rules[first].lastSame = ruleCount;
+	} else {
+		if (nameCount >= bucketCount) {
+			resizeIndex(bucketCount ? bucketCount * 2 : INDEX_START_SIZE);
+		}
+		int slot = hash & (bucketCount - 1);
+
+		rule->hashNext = buckets[slot];
+		buckets[slot] = ruleCount;
+		nameCount++;
+	}
+	ruleCount++;
+}
+
+
+/*
+ * freeIndex() -- Frees the rule index.
+ */
+static void freeIndex() {
+
+	free(rules);
+	free(buckets);
+	rules = NULL;
+	buckets = NULL;
+	ruleCount = 0;
+	ruleSize = 0;
+	bucketCount = 0;
+	nameCount = 0;
+}
+
+
+/*
+ * scanRules(data, end) -- Indexes every rule line of the makefile mapped from `data` to
+ * `end` by its target: the first word of the line, up to a space or a colon. Only the
+ * start of each line and the first word of rule lines are read; the rest of the line
+ * is checked when the rule is parsed.
+ *
+ * Error Handling:
+ * - Exits if a command comes before the first rule.
+ * - Exits if a rule line has no target, since no goal can reach it to report it later.
+ */
+static void scanRules(char *data, char *end) {
+
+	char *pos = data;
+
+	while (pos < end) {
+
+		char *eol = memchr(pos, '\n', end - pos);
+		if (eol == NULL) {
+			eol = end;
+		}
+
+		if (*pos == '\t') {
+			if (ruleCount == 0) {
+				freeLL();
+				fprintf(stderr, "Invalid Format. Commands Cannot be First.\n");
+				exit(1);
+			}
+		} else {
+			char *word = pos;
+			while (word < eol && isspace(*word)) {
+				word++;
+			}
+			char *cur = word;
+			while (cur < eol && !isspace(*cur) && *cur != ':') {
+				cur++;
+			}
+
+			if (cur == word && word < eol) {
+				useActionLineAndAddNodes(pos, eol);
+			} else if (cur > word) {
+				addRuleLine(word, cur - word, pos);
+			}
+		}
+		pos = eol + 1;
+	}
+}
+
+
+/*
+ * isDeclaration(rule) -- Returns whether `rule` is a `.PHONY` or `.RESTAT` line, which
+ * declares something about other targets instead of being a rule.
+ */
+static int isDeclaration(struct ruleLine *rule) {
+
+	return (rule->len == 6 && memcmp(rule->name, ".PHONY", 6) == 0)
+		|| (rule->len == 7 && memcmp(rule->name, ".RESTAT", 7) == 0);
+}
+
+
+/*
+ * applyDeclarations(first, end) -- Applies every `.PHONY` or `.RESTAT` line in the chain
+ * of rule lines starting at `first` (`-1` for none) to the nodes it names, in a mapped
+ * makefile that ends at `end`. Only nodes already in the graph are marked; a name the
+ * goals cannot reach is skipped rather than added. Returns how many lines it applied.
+ *
+ * Error Handling:
+ * - Exits if a line has no colon or more than one, as a whole-file parse would.
+ */
+static int applyDeclarations(int first, char *end) {
+
+	int count = 0;
+	int rule;
+
+	for (rule = first; rule >= 0; rule = rules[rule].nextSame) {
+		char *line = rules[rule].line;
+		char *eol = memchr(line, '\n', end - line);
+		int phony = rules[rule].len == 6;
+
+		if (eol == NULL) {
+			eol = end;
+		}
+
+		char *cur = memchr(line, ':', eol - line);
+		if (cur == NULL || memchr(cur + 1, ':', eol - cur - 1) != NULL) {
+			freeLL();
+			fprintf(stderr, "Invalid Format, either no or one too many Colons.\n");
+			exit(1);
+		}
+
+		cur++;
+		while (cur < eol) {
+			while (cur < eol && isspace(*cur)) {
+				cur++;
+			}
+			char *word = cur;
+			while (cur < eol && !isspace(*cur)) {
+				cur++;
+			}
+
+			struct parentNode *node = cur > word ? tableFind(word, cur - word) : NULL;
+			if (node == NULL) {
+				continue;
+			}
+			if (phony) {
+				graph.flags[node->id].phony = 1;
+			} else {
+				graph.flags[node->id].restat = 1;
+			}
+		}
+		count++;
+	}
+	return count;
+}
+
+
+/*
+ * abandonParse(data, size) -- Drops the index, the mapping of `size` bytes at `data` and
+ * whatever part of the graph was built, so the caller can build the graph another way.
+ */
+static void abandonParse(char *data, off_t size) {
+
+	freeIndex();
+	munmap(data, size);
+	freeLL();
+}
+
+
+/*
+ * parseGoals(makeFileName, fp, names, count) -- Builds only the part of the graph that the
+ * `count` goals in `names` can reach in the open makefile `fp`. Scans the makefile with
+ * `scanRules`, then adds the goals and parses the rules of each node in the order nodes are
+ * added, which adds their prerequisites in turn, and finally applies the `.PHONY` and
+ * `.RESTAT` lines to the nodes that are there. Sets `partialGraph` if some rule was never parsed. Format errors
+ * are reported for the rules that are parsed.
+ *
+ * Returns:
+ * - `1` if the graph was built.
+ * - `0` if the caller must build the graph another way: lazy parsing is off, `fp` cannot be
+ *   mapped, a goal has no rule of its own and may only be a prerequisite somewhere, or the
+ *   goals reach more than one rule in `CACHE_FRACTION` and the graph cache of `makeFileName`
+ *   is current, which then loads faster than the rest of the rules would parse.
+ */
+int parseGoals(char *makeFileName, FILE *fp, char **names, int count) {
+
+	struct stat fileData;
+
+	if (!useLazyParse || !useMmap || count == 0 || fstat(fileno(fp), &fileData) != 0
+			|| !S_ISREG(fileData.st_mode) || fileData.st_size == 0) {
+		return 0;
+	}
+
+	char *data = mmap(NULL, fileData.st_size, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+	if (data == MAP_FAILED) {
+		return 0;
+	}
+	char *end = data + fileData.st_size;
+
+	scanRules(data, end);
+
+	int index;
+	for (index = 0; index < count; index++) {
+		size_t len = strlen(names[index]);
+
+		if (findRule(names[index], len, hashName(names[index], len)) < 0) {
+			abandonParse(data, fileData.st_size);
+			return 0;
+		}
+	}
+
+	for (index = 0; index < count; index++) {
+		internNode(names[index], strlen(names[index]));
+	}
+
+	int phony = findRule(".PHONY", 6, hashName(".PHONY", 6));
+	int restat = findRule(".RESTAT", 7, hashName(".RESTAT", 7));
+	int parsed = 0;
+	int checkCache = 1;
+	int rule;
+	int id;
+
+	// Nodes added while parsing a rule get the next ids, so this reaches every one.
+	for (id = 0; id < graphSize; id++) {
+		struct parentNode *node = graph.nodes[id];
+
+		if (checkCache && parsed > ruleCount / CACHE_FRACTION) {
+			checkCache = 0;
+			if (graphCacheIsCurrent(makeFileName, fp)) {
+				abandonParse(data, fileData.st_size);
+				return 0;
+			}
+		}
+
+		rule = findRule(node->name, strlen(node->name), node->nameHash);
+		for (; rule >= 0 && rule != phony && rule != restat; rule = rules[rule].nextSame) {
+			parseRule(rules[rule].line, end);
+			parsed++;
+		}
+	}
+
+	parsed += applyDeclarations(phony, end);
+	parsed += applyDeclarations(restat, end);
+
+	// The default goal is the target of the first rule in the file, as in a whole-file parse.
+	rule = 0;
+	while (rule < ruleCount && isDeclaration(&rules[rule])) {
+		rule++;
+	}
+	struct parentNode *first = rule < ruleCount ? tableFind(rules[rule].name, rules[rule].len) : NULL;
+	targetNode = first != NULL ? first->name : NULL;
+
+	partialGraph = parsed < ruleCount;
+	finishParse();
+	freeIndex();
+	munmap(data, fileData.st_size);
+	return 1;
+}
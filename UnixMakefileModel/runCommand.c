@@ -0,0 +1,324 @@
+/*
+* File: runCommand.c
+* Author: Chance Krueger
+* Purpose: Defines the layer that starts recipe lines as processes.
+* Lines without shell syntax are split on whitespace and started
+* directly with `posix_spawnp`, skipping the `/bin/sh` startup that
+* `system()` pays for every line. Lines that need a shell still run
+* through `/bin/sh -c`. With `--one-shell` all recipe lines of a
+* target are joined into one script and run by a single shell. Either
+* can be given a descriptor to use as stdout and stderr, for the
+* output layer (see outputCapture.c). The
+* time spent starting each line is kept per path so they can be
+* compared with `--spawn-stats`.
+*/
+
+
+# include "header.h"
+# include <errno.h>
+# include <spawn.h>
+# include <time.h>
+# include <unistd.h>
+
+extern char **environ;
+
+// GLOBAL VARIBLES
+int shellOnly = 0;
+int spawnStats = 0;
+int oneShell = 0;
+
+// Indexed by path: 0 for a shell, 1 for a direct start, 2 for a script.
+static long spawnCount[3] = {0, 0, 0};
+static double spawnNanos[3] = {0, 0, 0};
+static double lineNanos[3] = {0, 0, 0};
+
+// Words that only mean something to the shell itself.
+static const char *builtins[] = {
+	"cd", "exit", "export", "unset", "set", "source", ".", "exec", "eval",
+	"ulimit", "umask", "alias", "read", "wait", "trap", "shift", "return",
+	"break", "continue", "readonly", "local", "type", "hash", NULL
+};
+
+
+/*
+ * needsShell(line) -- Decides whether `line` must be run by `/bin/sh`.
+ * Returns `1` if the line has quoting, redirection, pipes, expansions,
+ * globs, a leading variable assignment or starts with a shell builtin,
+ * otherwise returns `0` so it can be split on whitespace and run directly.
+ */
+int needsShell(const char *line) {
+
+	if (strpbrk(line, "|&;<>()$`\\\"'*?[]#~{}!\n") != NULL) {
+		return 1;
+	}
+
+	size_t wordLen = strcspn(line, " \t");
+
+	// FOO=bar cmd
+	if (memchr(line, '=', wordLen) != NULL) {
+		return 1;
+	}
+
+	int index;
+	for (index = 0; builtins[index] != NULL; index++) {
+		if (strlen(builtins[index]) == wordLen && strncmp(line, builtins[index], wordLen) == 0) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * splitLine(copy, argv) -- Splits `copy` on whitespace in place, filling `argv`.
+ * `argv` must have room for one pointer per character of `copy` plus one.
+ * Returns the number of words found.
+ */
+int splitLine(char *copy, char **argv) {
+
+	int argc = 0;
+
+	while (*copy != 0) {
+		while (isspace(*copy)) {
+			*copy++ = 0;
+		}
+		if (*copy == 0) {
+			break;
+		}
+		argv[argc++] = copy;
+		while (*copy != 0 && !isspace(*copy)) {
+			copy++;
+		}
+	}
+	argv[argc] = NULL;
+	return argc;
+}
+
+
+/*
+ * elapsedNanos(start) -- Returns the nanoseconds from `start` until now.
+ */
+double elapsedNanos(struct timespec *start) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e9 + (now.tv_nsec - start->tv_nsec);
+}
+
+
+/*
+ * outputActions(output, actions) -- Sets up `actions` to make `output` the stdout and
+ * stderr of a child and returns it, or returns `NULL` if `output` is `-1` and the child
+ * keeps ours. Exits if memory allocation fails.
+ */
+static posix_spawn_file_actions_t *outputActions(int output, posix_spawn_file_actions_t *actions) {
+
+	if (output < 0) {
+		return NULL;
+	}
+	if (posix_spawn_file_actions_init(actions) != 0
+			|| posix_spawn_file_actions_adddup2(actions, output, STDOUT_FILENO) != 0
+			|| posix_spawn_file_actions_adddup2(actions, output, STDERR_FILENO) != 0) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	return actions;
+}
+
+
+/*
+ * runLine(line, direct, output) -- Starts `line` as a child process and returns its pid.
+ * Sets `*direct` to `1` if the line was started without a shell. The child writes its
+ * stdout and stderr to `output`, or to ours if it is `-1`. Flushes stdout
+ * first so the commands already printed come out before anything the child
+ * writes. If the program cannot be started, prints why and returns `-1` so
+ * the caller can treat the line as failed.
+ */
+pid_t runLine(char *line, int *direct, int output) {
+
+	fflush(stdout);
+
+	*direct = !shellOnly && !needsShell(line);
+	pid_t pid;
+	int err;
+
+	struct timespec start;
+	posix_spawn_file_actions_t actionsData;
+	posix_spawn_file_actions_t *actions = outputActions(output, &actionsData);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	if (*direct) {
+		size_t len = strlen(line);
+		char *copy = malloc(len + 1);
+		char **argv = malloc((len / 2 + 2) * sizeof(char *));
+
+		if (copy == NULL || argv == NULL) {
+			freeLL();
+			fprintf(stderr, "Ran Out of Memory.\n");
+			exit(1);
+		}
+		memcpy(copy, line, len + 1);
+		splitLine(copy, argv);
+
+		err = posix_spawnp(&pid, argv[0], actions, NULL, argv, environ);
+		if (err != 0) {
+			fprintf(stderr, "%s: %s\n", argv[0], strerror(err));
+		}
+		free(argv);
+		free(copy);
+	} else {
+		char *argv[] = {"sh", "-c", line, NULL};
+
+		err = posix_spawn(&pid, "/bin/sh", actions, NULL, argv, environ);
+		if (err != 0) {
+			fprintf(stderr, "/bin/sh: %s\n", strerror(err));
+		}
+	}
+	if (actions != NULL) {
+		posix_spawn_file_actions_destroy(actions);
+	}
+
+	spawnCount[*direct]++;
+	spawnNanos[*direct] += elapsedNanos(&start);
+
+	if (err != 0) {
+		return -1;
+	}
+	return pid;
+}
+
+
+/*
+ * appendQuoted(script, text) -- Appends `text` to `script` inside single quotes,
+ * so the shell reads it back unchanged. Returns the end of what was written.
+ */
+static char *appendQuoted(char *script, const char *text) {
+
+	*script++ = '\'';
+	while (*text != 0) {
+		if (*text == '\'') {
+			memcpy(script, "'\\''", 4);
+			script += 4;
+		} else {
+			*script++ = *text;
+		}
+		text++;
+	}
+	*script++ = '\'';
+	return script;
+}
+
+
+/*
+ * runScript(line, count, output) -- Starts every non-empty recipe line from `line` on as
+ * one `/bin/sh -c` script writing to `output` (see `runLine`) and returns its pid, or `-1`
+ * if the shell cannot be started.
+ * The script runs under `set -e` and prints each line after it succeeds, so the
+ * output is the same as running the lines one by one and it stops at the first
+ * line that fails, whose exit status becomes the script's. Sets `*count` to the
+ * number of lines in the script.
+ */
+pid_t runScript(struct LineNode *line, int *count, int output) {
+
+	fflush(stdout);
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	size_t size = sizeof("set -e\n");
+	struct LineNode *temp;
+	for (temp = line; temp != NULL; temp = temp->next) {
+		// The line, a newline that ends a trailing backslash, and the quoted echo.
+		size += 5 * strlen(temp->line) + sizeof("\n\nprintf '%s\\n' ''\n");
+	}
+
+	char *script = malloc(size);
+
+	if (script == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+
+	char *end = script + sprintf(script, "set -e\n");
+	*count = 0;
+	for (temp = line; temp != NULL; temp = temp->next) {
+		size_t len = strlen(temp->line);
+
+		if (len == 0) {
+			continue;
+		}
+		memcpy(end, temp->line, len);
+		end += len;
+		*end++ = '\n';
+		if (temp->line[len - 1] == '\\') {
+			*end++ = '\n';
+		}
+		end += sprintf(end, "printf '%%s\\n' ");
+		end = appendQuoted(end, temp->line);
+		*end++ = '\n';
+		(*count)++;
+	}
+	*end = 0;
+
+	char *argv[] = {"sh", "-c", script, NULL};
+	posix_spawn_file_actions_t actionsData;
+	posix_spawn_file_actions_t *actions = outputActions(output, &actionsData);
+	pid_t pid;
+	int err = posix_spawn(&pid, "/bin/sh", actions, NULL, argv, environ);
+
+	if (err != 0) {
+		fprintf(stderr, "/bin/sh: %s\n", strerror(err));
+	}
+	if (actions != NULL) {
+		posix_spawn_file_actions_destroy(actions);
+	}
+	free(script);
+
+	spawnCount[2]++;
+	spawnNanos[2] += elapsedNanos(&start);
+
+	if (err != 0) {
+		return -1;
+	}
+	return pid;
+}
+
+
+/*
+ * recordLineTime(direct, nanos) -- Adds the time a line took from being
+ * started until it was reaped to the totals for its path (`2` for a script).
+ */
+void recordLineTime(int direct, double nanos) {
+
+	lineNanos[direct] += nanos;
+}
+
+
+/*
+ * printSpawnStats() -- Prints how many lines were started on each path,
+ * the average time it took to start one and the average time from start
+ * to exit (which includes shell startup), if `--spawn-stats` was given.
+ * With `--one-shell` the scripts are counted as a path of their own.
+ */
+void printSpawnStats() {
+
+	if (!spawnStats) {
+		return;
+	}
+
+	const char *names[] = {"shell", "direct", "script"};
+	int kinds[] = {1, 0, 2};
+	int index;
+
+	for (index = 0; index < (oneShell ? 3 : 2); index++) {
+		int kind = kinds[index];
+		long count = spawnCount[kind] ? spawnCount[kind] : 1;
+
+		fprintf(stderr, "spawn %-6s %8ld lines %10.1f us spawn %10.1f us total per line\n",
+				names[kind], spawnCount[kind], spawnNanos[kind] / count / 1e3,
+				lineNanos[kind] / count / 1e3);
+	}
+}
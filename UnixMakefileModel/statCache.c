@@ -0,0 +1,122 @@
+/*
+* File: statCache.c
+* Author: Chance Krueger
+* Purpose: Defines the stat cache. Every file name is interned once
+* with a dense id, so the result of probing it is stored in the graph
+* arrays under that id: the full nanosecond `st_mtim`, or the error
+* if the file is missing. A node is stat'ed at most once per build unless
+* its recipe ran, and the number of calls issued and avoided is
+* counted so it can be printed with `--stat-stats`. Most nodes are
+* already filled in by the batched pre-pass in statPrefetch.c.
+*/
+
+
+# include "header.h"
+# include <errno.h>
+
+// GLOBAL VARIBLES
+int statStats = 0;
+long statCalls = 0;
+long statsAvoided = 0;
+
+
+/*
+ * compareTime(first, second) -- Compares two modification times.
+ * Returns a negative number if `first` is older, `0` if they are equal
+ * and a positive number if `first` is newer.
+ */
+int compareTime(struct timespec first, struct timespec second) {
+
+	if (first.tv_sec != second.tv_sec) {
+		return first.tv_sec < second.tv_sec ? -1 : 1;
+	}
+	if (first.tv_nsec != second.tv_nsec) {
+		return first.tv_nsec < second.tv_nsec ? -1 : 1;
+	}
+	return 0;
+}
+
+
+/*
+ * storeStat(id, fileData, error) -- Caches the result of probing node `id`: the mtime,
+ * inode and size in `fileData` if `error` is `0`, or the `errno` value `error` if the
+ * file is missing. Different nodes can be stored from different threads at once.
+ */
+void storeStat(int id, struct stat *fileData, int error) {
+
+	struct nodeFlags *flags = &graph.flags[id];
+	struct parentNode *node = graph.nodes[id];
+
+	if (error == 0) {
+		graph.mtime[id] = fileData->st_mtim;
+		node->fileIno = fileData->st_ino;
+		node->fileSize = fileData->st_size;
+		flags->doesExist = 1; //both of these values set by calling stat()
+		flags->statState = STAT_EXISTS;
+	} else {
+		node->statError = error;
+		flags->doesExist = 0;
+		flags->statState = STAT_MISSING;
+	}
+}
+
+
+/*
+ * statNode(id) -- Fills in `graph.mtime[id]` and the `doesExist` flag of node `id` from the file system.
+ * Only calls `stat()` the first time a node is probed (or after `forgetStat`);
+ * later calls return the cached result. Returns `0` if the file exists and
+ * `-1` with `errno` set if it does not.
+ */
+int statNode(int id) {
+
+	struct nodeFlags *flags = &graph.flags[id];
+	struct parentNode *node = graph.nodes[id];
+
+	if (flags->statState != STAT_UNKNOWN) {
+		statsAvoided++;
+
+		if (flags->statState == STAT_MISSING) {
+			errno = node->statError;
+			return -1;
+		}
+		return 0;
+	}
+
+	struct stat fileData;
+	struct timespec start;
+	statCalls++;
+
+	if (traceFile != NULL) {
+		clock_gettime(CLOCK_MONOTONIC, &start);
+	}
+
+	int error = stat(node->name, &fileData) == 0 ? 0 : errno;
+
+	storeStat(id, &fileData, error);
+	traceStat(id, &start);
+	errno = error;
+	return error == 0 ? 0 : -1;
+}
+
+
+/*
+ * forgetStat(id) -- Drops the cached result for node `id`, so the next
+ * `statNode` call probes the file again. Used after a recipe ran.
+ */
+void forgetStat(int id) {
+
+	graph.flags[id].statState = STAT_UNKNOWN;
+}
+
+
+/*
+ * printStatStats() -- Prints how many `stat()` calls were issued and how
+ * many were answered from the cache, if `--stat-stats` was given.
+ */
+void printStatStats() {
+
+	if (!statStats) {
+		return;
+	}
+	fprintf(stderr, "stat calls %ld, avoided %ld\n", statCalls, statsAvoided);
+}
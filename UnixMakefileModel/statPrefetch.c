@@ -0,0 +1,407 @@
+/*
+* File: statPrefetch.c
+* Author: Chance Krueger
+* Purpose: Defines the stat pre-pass that runs before the traversal.
+* It collects every file-backed node reachable from the goals and
+* probes them all at once instead of one at a time inside `POT`, so
+* that on a slow file system (NFS) the round trips overlap. The
+* queries go through io_uring `IORING_OP_STATX` when the kernel
+* supports it, and through a pool of threads calling `stat()`
+* otherwise. Results are stored in the stat cache, where `POT` finds
+* them.
+*/
+
+
+#define _GNU_SOURCE
+# include "header.h"
+# include <errno.h>
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/syscall.h>
+# include <linux/io_uring.h>
+
+#define PREFETCH_MIN 64
+#define PREFETCH_THREADS 32
+#define RING_ENTRIES 256
+
+/*
+ * struct ring -- An io_uring instance set up with raw system calls. Stores the
+ * ring descriptor (`fd`), the mapped submission and completion rings and their
+ * sizes, and pointers to the head, tail, mask and array fields inside them.
+ */
+struct ring {
+	int fd;
+	unsigned entries;
+	void *sqMap;
+	size_t sqMapSize;
+	void *cqMap;
+	size_t cqMapSize;
+	struct io_uring_sqe *sqes;
+	size_t sqesSize;
+	unsigned *sqHead;
+	unsigned *sqTail;
+	unsigned *sqMask;
+	unsigned *sqArray;
+	unsigned *cqHead;
+	unsigned *cqTail;
+	unsigned *cqMask;
+	struct io_uring_cqe *cqes;
+};
+
+// GLOBAL VARIBLES
+int usePrefetch = 1;
+int useIoUring = 1;
+
+static int *probeIds = NULL;
+static long probeCount = 0;
+static long probeNext = 0;
+static long prefetched = 0;
+static const char *prefetchedWith = NULL;
+static double prefetchNanos = 0;
+
+
+/*
+ * collectProbes(targets, count) -- Fills `probeIds` with every node reachable from the
+ * `count` goals in `targets` whose file has not been stat'ed yet. Phony targets name no
+ * file, so they are walked through but not probed.
+ */
+static void collectProbes(struct parentNode **targets, int count) {
+
+	unsigned char *seen = calloc(graphSize ? graphSize : 1, 1);
+	int *stack = malloc((graphSize ? graphSize : 1) * sizeof(int));
+	int depth = 0;
+	int index;
+
+	probeIds = malloc((graphSize ? graphSize : 1) * sizeof(int));
+	probeCount = 0;
+	if (seen == NULL || stack == NULL || probeIds == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+
+	for (index = 0; index < count; index++) {
+		if (!seen[targets[index]->id]) {
+			seen[targets[index]->id] = 1;
+			stack[depth++] = targets[index]->id;
+		}
+	}
+
+	while (depth > 0) {
+		int id = stack[--depth];
+		int edge;
+
+		if (!graph.flags[id].phony && graph.flags[id].statState == STAT_UNKNOWN) {
+			probeIds[probeCount++] = id;
+		}
+		for (edge = graph.childStart[id]; edge < graph.childStart[id + 1]; edge++) {
+			int child = graph.childIds[edge];
+
+			if (!seen[child]) {
+				seen[child] = 1;
+				stack[depth++] = child;
+			}
+		}
+	}
+
+	free(seen);
+	free(stack);
+}
+
+
+/*
+ * closeRing(ring) -- Unmaps the rings of `ring` and closes it.
+ */
+static void closeRing(struct ring *ring) {
+
+	if (ring->sqes != NULL) {
+		munmap(ring->sqes, ring->sqesSize);
+	}
+	if (ring->cqMap != NULL && ring->cqMap != ring->sqMap) {
+		munmap(ring->cqMap, ring->cqMapSize);
+	}
+	if (ring->sqMap != NULL) {
+		munmap(ring->sqMap, ring->sqMapSize);
+	}
+	close(ring->fd);
+}
+
+
+/*
+ * openRing(ring) -- Sets up an io_uring with `RING_ENTRIES` entries and checks that it
+ * supports `IORING_OP_STATX`. Returns `1` on success, or `0` if io_uring is missing,
+ * disabled or too old, in which case nothing is left open.
+ */
+static int openRing(struct ring *ring) {
+
+	struct io_uring_params params;
+
+	memset(ring, 0, sizeof(*ring));
+	memset(&params, 0, sizeof(params));
+
+	ring->fd = syscall(__NR_io_uring_setup, RING_ENTRIES, &params);
+	if (ring->fd < 0) {
+		return 0;
+	}
+
+	// Kernels without the probe op (before 5.6) have no statx op either.
+	size_t probeSize = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+	struct io_uring_probe *probe = calloc(1, probeSize);
+
+	if (probe == NULL || syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_PROBE, probe, 256) < 0
+			|| probe->last_op < IORING_OP_STATX || !(probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED)) {
+		free(probe);
+		close(ring->fd);
+		return 0;
+	}
+	free(probe);
+
+	ring->entries = params.sq_entries;
+	ring->sqMapSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+	ring->cqMapSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ring->cqMapSize > ring->sqMapSize) {
+			ring->sqMapSize = ring->cqMapSize;
+		}
+		ring->cqMapSize = ring->sqMapSize;
+	}
+
+	ring->sqMap = mmap(NULL, ring->sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+	if (ring->sqMap == MAP_FAILED) {
+		ring->sqMap = NULL;
+		closeRing(ring);
+		return 0;
+	}
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ring->cqMap = ring->sqMap;
+	} else {
+		ring->cqMap = mmap(NULL, ring->cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+		if (ring->cqMap == MAP_FAILED) {
+			ring->cqMap = NULL;
+			closeRing(ring);
+			return 0;
+		}
+	}
+	ring->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqes = mmap(NULL, ring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+	if (ring->sqes == MAP_FAILED) {
+		ring->sqes = NULL;
+		closeRing(ring);
+		return 0;
+	}
+
+	char *sq = ring->sqMap;
+	char *cq = ring->cqMap;
+	ring->sqHead = (unsigned *)(sq + params.sq_off.head);
+	ring->sqTail = (unsigned *)(sq + params.sq_off.tail);
+	ring->sqMask = (unsigned *)(sq + params.sq_off.ring_mask);
+	ring->sqArray = (unsigned *)(sq + params.sq_off.array);
+	ring->cqHead = (unsigned *)(cq + params.cq_off.head);
+	ring->cqTail = (unsigned *)(cq + params.cq_off.tail);
+	ring->cqMask = (unsigned *)(cq + params.cq_off.ring_mask);
+	ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+	return 1;
+}
+
+
+/*
+ * storeStatx(id, buffer, error) -- Stores a `statx` result for node `id` in the stat cache.
+ */
+static void storeStatx(int id, struct statx *buffer, int error) {
+
+	struct stat fileData;
+
+	memset(&fileData, 0, sizeof(fileData));
+	if (error == 0) {
+		fileData.st_mtim.tv_sec = buffer->stx_mtime.tv_sec;
+		fileData.st_mtim.tv_nsec = buffer->stx_mtime.tv_nsec;
+		fileData.st_ino = buffer->stx_ino;
+		fileData.st_size = buffer->stx_size;
+	}
+	storeStat(id, &fileData, error);
+}
+
+
+/*
+ * prefetchWithRing(ring) -- Probes every node in `probeIds` through `ring`, keeping up
+ * to one ring's worth of `statx` requests in flight. Each request in flight owns one
+ * of `entries` result buffers, whose number travels in `user_data`. Returns `1` when
+ * every result is stored, or `0` if `io_uring_enter` failed; results already stored
+ * are kept, and the rest are left for the caller.
+ */
+static int prefetchWithRing(struct ring *ring) {
+
+	struct statx *buffers = malloc(ring->entries * sizeof(struct statx));
+	int *owner = malloc(ring->entries * sizeof(int));
+	unsigned *freeSlots = malloc(ring->entries * sizeof(unsigned));
+	unsigned freeCount = ring->entries;
+	long submitted = 0;
+	long completed = 0;
+	unsigned slot;
+
+	if (buffers == NULL || owner == NULL || freeSlots == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	for (slot = 0; slot < ring->entries; slot++) {
+		freeSlots[slot] = slot;
+	}
+
+	while (completed < probeCount) {
+		unsigned tail = *ring->sqTail;
+
+		while (submitted < probeCount && freeCount > 0) {
+			unsigned index = tail & *ring->sqMask;
+			struct io_uring_sqe *sqe = &ring->sqes[index];
+
+			slot = freeSlots[--freeCount];
+			owner[slot] = probeIds[submitted];
+
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = AT_FDCWD;
+			sqe->addr = (unsigned long)graph.nodes[probeIds[submitted]]->name;
+			sqe->len = STATX_BASIC_STATS;
+			sqe->off = (unsigned long)&buffers[slot];
+			sqe->user_data = slot;
+			ring->sqArray[index] = index;
+
+			tail++;
+			submitted++;
+		}
+		__atomic_store_n(ring->sqTail, tail, __ATOMIC_RELEASE);
+
+		// Also hands over entries an earlier call did not take.
+		unsigned toSubmit = tail - __atomic_load_n(ring->sqHead, __ATOMIC_ACQUIRE);
+		if (syscall(__NR_io_uring_enter, ring->fd, toSubmit, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+
+		unsigned head = *ring->cqHead;
+		unsigned ready = __atomic_load_n(ring->cqTail, __ATOMIC_ACQUIRE);
+
+		for (; head != ready; head++) {
+			struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cqMask];
+
+			slot = cqe->user_data;
+			storeStatx(owner[slot], &buffers[slot], cqe->res < 0 ? -cqe->res : 0);
+			freeSlots[freeCount++] = slot;
+			completed++;
+		}
+		__atomic_store_n(ring->cqHead, head, __ATOMIC_RELEASE);
+	}
+
+	// Requests still in flight may yet write to their buffers, so those are kept.
+	if (freeCount == ring->entries) {
+		free(buffers);
+	}
+	free(owner);
+	free(freeSlots);
+	return completed == probeCount;
+}
+
+
+/*
+ * prefetchWorker(unused) -- Body of each thread of the pool. Takes the next node off
+ * `probeIds` and stats it until the list is empty.
+ */
+static void *prefetchWorker(void *unused) {
+
+	long index;
+
+	(void)unused;
+
+	while ((index = __atomic_fetch_add(&probeNext, 1, __ATOMIC_RELAXED)) < probeCount) {
+		int id = probeIds[index];
+
+		// Nodes already stored by the ring are skipped.
+		if (graph.flags[id].statState != STAT_UNKNOWN) {
+			continue;
+		}
+
+		struct stat fileData;
+		int error = stat(graph.nodes[id]->name, &fileData) == 0 ? 0 : errno;
+
+		storeStat(id, &fileData, error);
+	}
+	return NULL;
+}
+
+
+/*
+ * prefetchWithThreads() -- Probes every node in `probeIds` with `PREFETCH_THREADS`
+ * threads calling `stat()`. More threads than processors are used on purpose, since
+ * they spend their time waiting on the file system.
+ */
+static void prefetchWithThreads() {
+
+	probeNext = 0;
+	runPool(prefetchWorker, probeCount < PREFETCH_THREADS ? probeCount : PREFETCH_THREADS);
+}
+
+
+/*
+ * prefetchStats(targets, count) -- Stats every file reachable from the `count` goals in
+ * `targets` in one batch before the traversal, unless `--no-prefetch` was given or there
+ * are fewer than `PREFETCH_MIN` of them. Uses io_uring unless `--no-io-uring` was given
+ * or the kernel cannot do it, and the thread pool otherwise. The results are counted as
+ * `stat()` calls and traced from this thread once the whole batch is done.
+ */
+void prefetchStats(struct parentNode **targets, int count) {
+
+	struct timespec start;
+	struct ring ring;
+
+	prefetched = 0;
+	prefetchedWith = NULL;
+	if (!usePrefetch) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	collectProbes(targets, count);
+
+	if (probeCount >= PREFETCH_MIN) {
+		prefetchedWith = "threads";
+		if (useIoUring && openRing(&ring)) {
+			if (prefetchWithRing(&ring)) {
+				prefetchedWith = "io_uring";
+			} else {
+				prefetchWithThreads();
+			}
+			closeRing(&ring);
+		} else {
+			prefetchWithThreads();
+		}
+		prefetched = probeCount;
+		statCalls += probeCount;
+
+		long index;
+		for (index = 0; index < probeCount; index++) {
+			tracePrefetchedStat(probeIds[index]);
+		}
+	}
+
+	free(probeIds);
+	probeIds = NULL;
+	probeCount = 0;
+	prefetchNanos = elapsedNanos(&start);
+}
+
+
+/*
+ * printPrefetchStats() -- Prints how many files the pre-pass probed, how and how long
+ * it took, if `--stat-stats` was given and the pre-pass ran.
+ */
+void printPrefetchStats() {
+
+	if (!statStats || prefetchedWith == NULL) {
+		return;
+	}
+	fprintf(stderr, "stat prefetch %ld files with %s in %.3f ms\n", prefetched, prefetchedWith, prefetchNanos / 1e6);
+}
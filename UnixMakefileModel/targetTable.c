@@ -0,0 +1,156 @@
+/*
+* File: targetTable.c
+* Author: Chance Krueger
+* Purpose: Defines the hash index that sits on top of the `headLL`
+* graph. Every target name is interned exactly once (in its
+* `parentNode`), and all lookups and inserts go through this table
+* so that parsing a makefile costs time proportional to its tokens
+* instead of walking the whole node list for every name.
+*/
+
+
+# include "header.h"
+
+#define TABLE_START_SIZE 1024
+
+// GLOBAL VARIBLES
+struct parentNode *tailLL = NULL;
+
+static struct parentNode **buckets = NULL;
+static size_t bucketCount = 0;
+static size_t nodeCount = 0;
+
+
+/*
+ * hashBytes(hash, data, len) -- Continues the FNV-1a hash `hash` over `len` bytes of `data`.
+ */
+unsigned long hashBytes(unsigned long hash, const void *data, size_t len) {
+
+	const unsigned char *bytes = data;
+	size_t index;
+
+	for (index = 0; index < len; index++) {
+		hash ^= bytes[index];
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+
+/*
+ * hashName(name, len) -- Computes the FNV-1a hash of the first `len` bytes of `name`.
+ * Takes a pointer to the characters and a length so that names which are not
+ * null-terminated (slices of a larger line) can be hashed in place.
+ */
+unsigned long hashName(const char *name, size_t len) {
+
+	return hashBytes(14695981039346656037UL, name, len);
+}
+
+
+/*
+ * resizeTable(newCount) -- Moves every node into a new array of `newCount` buckets.
+ * Uses the hash stored in each node, so no names are re-read.
+ * Exits if memory allocation fails.
+ */
+static void resizeTable(size_t newCount) {
+
+	struct parentNode **newBuckets = calloc(newCount, sizeof(struct parentNode *));
+
+	if (newBuckets == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+
+	size_t index;
+	for (index = 0; index < bucketCount; index++) {
+		struct parentNode *cur = buckets[index];
+
+		while (cur != NULL) {
+			struct parentNode *next = cur->hashNext;
+			size_t slot = cur->nameHash & (newCount - 1);
+
+			cur->hashNext = newBuckets[slot];
+			newBuckets[slot] = cur;
+			cur = next;
+		}
+	}
+	free(buckets);
+	buckets = newBuckets;
+	bucketCount = newCount;
+}
+
+
+/*
+ * tableReserve(count) -- Makes room for `count` nodes in total, so that
+ * inserting that many nodes never has to grow the table.
+ */
+void tableReserve(size_t count) {
+
+	size_t newCount = bucketCount ? bucketCount : TABLE_START_SIZE;
+
+	while (newCount < count) {
+		newCount *= 2;
+	}
+	if (newCount > bucketCount) {
+		resizeTable(newCount);
+	}
+}
+
+
+/*
+ * tableFind(name, len) -- Looks up the node whose name equals the first `len` bytes of `name`.
+ * Returns a pointer to the `struct parentNode`, or `NULL` if no node with that
+ * name has been added to the graph yet.
+ */
+struct parentNode *tableFind(const char *name, size_t len) {
+
+	if (bucketCount == 0) {
+		return NULL;
+	}
+
+	unsigned long hash = hashName(name, len);
+	struct parentNode *cur = buckets[hash & (bucketCount - 1)];
+
+	while (cur != NULL) {
+		if (cur->nameHash == hash && strncmp(cur->name, name, len) == 0
+				&& cur->name[len] == 0) {
+			return cur;
+		}
+		cur = cur->hashNext;
+	}
+	return NULL;
+}
+
+
+/*
+ * tableInsert(node) -- Adds `node` to the hash index under `node->name`.
+ * Assumes `node->nameHash` already holds the hash of the name and that no
+ * node with the same name is already in the table; callers check with
+ * `tableFind` first. Grows the table when it becomes full.
+ */
+void tableInsert(struct parentNode *node) {
+
+	if (nodeCount >= bucketCount) {
+		resizeTable(bucketCount ? bucketCount * 2 : TABLE_START_SIZE);
+	}
+
+	size_t slot = node->nameHash & (bucketCount - 1);
+	node->hashNext = buckets[slot];
+	buckets[slot] = node;
+	nodeCount++;
+}
+
+
+/*
+ * tableFree() -- Frees the bucket array. The nodes themselves belong to
+ * `headLL` and are freed by `freeLL()`.
+ */
+void tableFree() {
+
+	free(buckets);
+	buckets = NULL;
+	bucketCount = 0;
+	nodeCount = 0;
+}
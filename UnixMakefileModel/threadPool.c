@@ -0,0 +1,43 @@
+/*
+* File: threadPool.c
+* Author: Chance Krueger
+* Purpose: Defines the thread pool shared by the content hashes of
+* `--hash` and the stat pre-pass. Each caller keeps its own work list
+* and a counter its worker takes the next item from, so the pool only
+* starts the threads, works alongside them and waits for them to end.
+*/
+
+
+# include "header.h"
+# include <pthread.h>
+
+
+/*
+ * runPool(worker, threads) -- Runs `worker` on up to `threads` new threads and on the
+ * calling thread, and returns once all of them have returned. `worker` must keep
+ * taking work until there is none left, so the calling thread alone finishes the
+ * job if no thread can be started. Exits if memory allocation fails.
+ */
+void runPool(void *(*worker)(void *), long threads) {
+
+	pthread_t *pool = malloc((threads > 0 ? threads : 1) * sizeof(pthread_t));
+	long index;
+	long started = 0;
+
+	if (pool == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+
+	for (index = 0; index < threads; index++) {
+		if (pthread_create(&pool[started], NULL, worker, NULL) == 0) {
+			started++;
+		}
+	}
+	worker(NULL);
+	for (index = 0; index < started; index++) {
+		pthread_join(pool[index], NULL);
+	}
+	free(pool);
+}
@@ -0,0 +1,151 @@
+/*
+* File: throttle.c
+* Author: Chance Krueger
+* Purpose: Defines the limits that hold back new recipes while the
+* machine is busy. With `-l N`, no recipe is started while more than
+* N processes are runnable, and with `--mem-floor MB`, none is started
+* while less than MB megabytes of memory are available. Both are read
+* from /proc (or from the directory given with `--proc-dir`, so the
+* limits can be tried with made-up readings) each time a recipe is
+* about to start. Recipes that are already running are never stopped,
+* and new ones start again on their own once the readings drop back
+* under the limits.
+*/
+
+
+# include "header.h"
+# include <limits.h>
+
+// GLOBAL VARIBLES
+double maxLoad = 0;
+long memoryFloor = 0;
+char *procDir = "/proc";
+
+static int holding = 0;
+static struct timespec heldSince;
+static long holdCount = 0;
+static double heldNanos = 0;
+
+
+/*
+ * readProcFile(name, buffer, size) -- Reads the file `name` of `procDir` into `buffer`
+ * of `size` bytes as a string. Returns `1` on success and `0` if it cannot be read.
+ */
+static int readProcFile(const char *name, char *buffer, size_t size) {
+
+	char path[PATH_MAX];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", procDir, name);
+	fp = fopen(path, "r");
+	if (fp == NULL) {
+		return 0;
+	}
+
+	size_t got = fread(buffer, 1, size - 1, fp);
+
+	buffer[got] = '\0';
+	fclose(fp);
+	return got > 0;
+}
+
+
+/*
+ * currentLoad(load) -- Reads the load into `load`: the number of runnable processes
+ * from loadavg, not counting this one, or the one-minute average if that field is
+ * missing. The average trails what was just started by many seconds, so with it
+ * a build would start every free slot before the load ever went up.
+ * Returns `1` on success and `0` if loadavg cannot be read.
+ */
+static int currentLoad(double *load) {
+
+	char buffer[256];
+	double average;
+	int runnable;
+
+	if (!readProcFile("loadavg", buffer, sizeof(buffer))) {
+		return 0;
+	}
+
+	int fields = sscanf(buffer, "%lf %*f %*f %d/", &average, &runnable);
+
+	if (fields < 1) {
+		return 0;
+	}
+	*load = fields == 2 ? runnable - 1 : average;
+	return 1;
+}
+
+
+/*
+ * availableMemory(megabytes) -- Reads how much memory is available into `megabytes`,
+ * from MemAvailable in meminfo, or MemFree on kernels without it.
+ * Returns `1` on success and `0` if meminfo cannot be read.
+ */
+static int availableMemory(long *megabytes) {
+
+	char buffer[4096];
+	char *field;
+	long kilobytes;
+
+	if (!readProcFile("meminfo", buffer, sizeof(buffer))) {
+		return 0;
+	}
+
+	field = strstr(buffer, "MemAvailable:");
+	if (field == NULL) {
+		field = strstr(buffer, "MemFree:");
+	}
+	if (field == NULL || sscanf(strchr(field, ':') + 1, "%ld", &kilobytes) != 1) {
+		return 0;
+	}
+	*megabytes = kilobytes / 1024;
+	return 1;
+}
+
+
+/*
+ * mayStartJob() -- Returns whether another recipe may start now: `1` if no limit is
+ * set or the readings are under both limits, `0` if one is over. A reading that
+ * cannot be taken does not hold anything back. Keeps track of how often and how
+ * long starts were held back.
+ */
+int mayStartJob() {
+
+	if (maxLoad <= 0 && memoryFloor <= 0) {
+		return 1;
+	}
+
+	double load;
+	long megabytes;
+	int busy = (maxLoad > 0 && currentLoad(&load) && load > maxLoad)
+		|| (memoryFloor > 0 && availableMemory(&megabytes) && megabytes < memoryFloor);
+
+	if (busy && !holding) {
+		holding = 1;
+		holdCount++;
+		clock_gettime(CLOCK_MONOTONIC, &heldSince);
+	} else if (!busy && holding) {
+		holding = 0;
+		heldNanos += elapsedNanos(&heldSince);
+	}
+	return !busy;
+}
+
+
+/*
+ * closeThrottle() -- Ends a build: prints how often and for how long new recipes were
+ * held back, if they were at all.
+ */
+void closeThrottle() {
+
+	if (holding) {
+		holding = 0;
+		heldNanos += elapsedNanos(&heldSince);
+	}
+	if (holdCount > 0) {
+		fprintf(stderr, "held back new recipes %ld times, %.2f s in all\n", holdCount, heldNanos / 1e9);
+	}
+	holdCount = 0;
+	heldNanos = 0;
+}
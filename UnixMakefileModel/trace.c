@@ -0,0 +1,243 @@
+/*
+* File: trace.c
+* Author: Chance Krueger
+* Purpose: Defines the build profiler behind `--trace FILE`. Writes
+* a Chrome trace-event JSON file that can be opened in a trace
+* viewer (chrome://tracing or Perfetto). It holds one span per
+* phase of the run (loading or parsing the makefile, the traversal,
+* running the jobs, the build database), one span per `stat()` call,
+* an instant event for every file the stat pre-pass probed in a batch,
+* at the end of its phase, an instant event for every decision about whether a target must be
+* built and why, and one span per recipe line on the track of the
+* job slot that ran it, with its process ID and exit status.
+*/
+
+
+# include "header.h"
+# include <unistd.h>
+
+// GLOBAL VARIBLES
+FILE *traceFile = NULL;
+
+static struct timespec traceStart;
+static int traceEvents = 0;
+static pid_t tracePid = 0;
+
+
+/*
+ * traceMicros(when) -- Returns `when` in microseconds since the trace was opened.
+ */
+static double traceMicros(struct timespec *when) {
+
+	return (when->tv_sec - traceStart.tv_sec) * 1e6 + (when->tv_nsec - traceStart.tv_nsec) / 1e3;
+}
+
+
+/*
+ * writeJsonString(text) -- Writes `text` to the trace as a quoted JSON string.
+ */
+static void writeJsonString(const char *text) {
+
+	fputc('"', traceFile);
+	for (; *text; text++) {
+		unsigned char c = *text;
+
+		if (c == '"' || c == '\\') {
+			fputc('\\', traceFile);
+			fputc(c, traceFile);
+		} else if (c < 0x20) {
+			fprintf(traceFile, "\\u%04x", c);
+		} else {
+			fputc(c, traceFile);
+		}
+	}
+	fputc('"', traceFile);
+}
+
+
+/*
+ * beginEvent(phase, name, cat, tid, when) -- Writes the common fields of one event.
+ * The caller adds any other fields and closes the object with `}`.
+ */
+static void beginEvent(char phase, const char *name, const char *cat, int tid, struct timespec *when) {
+
+	fputs(traceEvents++ ? ",\n" : "\n", traceFile);
+	fputs("{\"name\":", traceFile);
+	writeJsonString(name);
+	fprintf(traceFile, ",\"cat\":\"%s\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f",
+			cat, phase, (int)tracePid, tid, traceMicros(when));
+}
+
+
+/*
+ * writeDuration(start) -- Writes the duration of an event that began at `start` and ends now.
+ */
+static void writeDuration(struct timespec *start) {
+
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fprintf(traceFile, ",\"dur\":%.3f", traceMicros(&now) - traceMicros(start));
+}
+
+
+/*
+ * nameTrack(tid, name) -- Writes the metadata event that names track `tid` in the viewer.
+ */
+static void nameTrack(int tid, const char *name) {
+
+	beginEvent('M', "thread_name", "__metadata", tid, &traceStart);
+	fputs(",\"args\":{\"name\":", traceFile);
+	writeJsonString(name);
+	fputs("}}", traceFile);
+}
+
+
+/*
+ * openTrace(path) -- Starts writing a trace to `path`. Track 0 holds the phases,
+ * stats and decisions, and tracks 1 to `jobSlots` hold the recipe lines of each
+ * job slot. The trace is finished by `closeTrace`, which runs at exit. Exits if
+ * the file cannot be created.
+ */
+void openTrace(char *path) {
+
+	traceFile = fopen(path, "w");
+
+	if (traceFile == NULL) {
+		perror(path);
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &traceStart);
+	tracePid = getpid();
+	fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", traceFile);
+
+	nameTrack(0, "mymake");
+	int slot;
+	for (slot = 1; slot <= jobSlots; slot++) {
+		char name[32];
+		snprintf(name, sizeof(name), "slot %d", slot);
+		nameTrack(slot, name);
+	}
+	atexit(closeTrace);
+}
+
+
+/*
+ * closeTrace() -- Finishes and closes the trace, if one is open.
+ * Also runs at exit, so a build that fails still leaves a valid trace.
+ */
+void closeTrace() {
+
+	if (traceFile == NULL) {
+		return;
+	}
+	fputs("\n]}\n", traceFile);
+	fclose(traceFile);
+	traceFile = NULL;
+}
+
+
+/*
+ * tracePhase(name, start) -- Records a phase of the run that began at `start` and ends now.
+ */
+void tracePhase(const char *name, struct timespec *start) {
+
+	if (traceFile == NULL) {
+		return;
+	}
+	beginEvent('X', name, "phase", 0, start);
+	writeDuration(start);
+	fputs("}", traceFile);
+}
+
+
+/*
+ * writeStatResult(id) -- Writes the result of the last stat of node `id` as the
+ * arguments of an event, and closes the event.
+ */
+static void writeStatResult(int id) {
+
+	if (graph.flags[id].doesExist) {
+		fprintf(traceFile, ",\"args\":{\"exists\":true,\"mtime\":\"%lld.%09ld\"}}",
+				(long long)graph.mtime[id].tv_sec, graph.mtime[id].tv_nsec);
+	} else {
+		fputs(",\"args\":{\"exists\":false}}", traceFile);
+	}
+}
+
+
+/*
+ * traceStat(id, start) -- Records a `stat()` of node `id` that began at `start` and its result.
+ */
+void traceStat(int id, struct timespec *start) {
+
+	if (traceFile == NULL) {
+		return;
+	}
+	beginEvent('X', graph.nodes[id]->name, "stat", 0, start);
+	writeDuration(start);
+	writeStatResult(id);
+}
+
+
+/*
+ * tracePrefetchedStat(id) -- Records the result of the stat of node `id` made by the
+ * stat pre-pass. Its calls overlap inside the batch, so each is recorded as an
+ * instant when the batch is done rather than as a span of its own.
+ */
+void tracePrefetchedStat(int id) {
+
+	if (traceFile == NULL) {
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	beginEvent('i', graph.nodes[id]->name, "stat", 0, &now);
+	fputs(",\"s\":\"t\"", traceFile);
+	writeStatResult(id);
+}
+
+
+/*
+ * traceDecision(id, reason, other) -- Records whether node `id` must be built and why.
+ * `other` is the id of the prerequisite that caused the decision, or `-1`.
+ */
+void traceDecision(int id, const char *reason, int other) {
+
+	if (traceFile == NULL) {
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	beginEvent('i', graph.nodes[id]->name, "decision", 0, &now);
+	fprintf(traceFile, ",\"s\":\"t\",\"args\":{\"build\":%s,\"reason\":", graph.flags[id].mustBuild ? "true" : "false");
+	writeJsonString(reason);
+	if (other >= 0) {
+		fputs(",\"prerequisite\":", traceFile);
+		writeJsonString(graph.nodes[other]->name);
+	}
+	fputs("}}", traceFile);
+}
+
+
+/*
+ * traceLine(line, id, slot, pid, start, status) -- Records one recipe line of node `id`
+ * that job slot `slot` ran as process `pid` from `start` until now. `status` is its
+ * exit status, or `-1` if it was killed by a signal or could not be started.
+ */
+void traceLine(char *line, int id, int slot, pid_t pid, struct timespec *start, int status) {
+
+	if (traceFile == NULL) {
+		return;
+	}
+	beginEvent('X', line, "recipe", slot + 1, start);
+	writeDuration(start);
+	fputs(",\"args\":{\"target\":", traceFile);
+	writeJsonString(graph.nodes[id]->name);
+	fprintf(traceFile, ",\"pid\":%d,\"slot\":%d,\"status\":%d}}", (int)pid, slot + 1, status);
+}
@@ -0,0 +1,495 @@
+/*
+* File: watch.c
+* Author: Chance Krueger
+* Purpose: Defines the `--watch` mode. The makefile is parsed and the
+* goals built once, then the graph stays in memory and inotify reports
+* changes to the leaf prerequisites (files that are not targets) and
+* to the makefile. A changed leaf is stat'ed again and only its cone
+* of reverse dependencies is scheduled, so a rebuild after one edit
+* costs time in proportion to what depends on that file rather than
+* to the size of the graph. A changed makefile is parsed again and the
+* goals rebuilt from scratch, unless the new makefile has a format
+* error, in which case the previous graph is kept. Runs until
+* interrupted.
+*/
+
+
+# include "header.h"
+# include <errno.h>
+# include <poll.h>
+# include <signal.h>
+# include <unistd.h>
+# include <sys/inotify.h>
+# include <sys/wait.h>
+
+#define WATCH_MASK (IN_CLOSE_WRITE | IN_ATTRIB | IN_MOVED_TO | IN_CREATE | IN_DELETE | IN_MOVED_FROM)
+#define WATCH_SETTLE_MS 20
+
+/*
+ * struct watchDir -- One watched directory. Stores the inotify watch
+ * descriptor (`wd`) and the prefix (`prefix`, empty or ending in `/`)
+ * that turns a file name reported for it back into a node name. Names
+ * spelled with different prefixes for the same directory share a `wd`.
+ */
+struct watchDir {
+	int wd;
+	char *prefix;
+};
+
+static int notifyFd = -1;
+static struct watchDir *dirs = NULL;
+static int dirCount = 0;
+static volatile sig_atomic_t stopWatching = 0;
+
+static int *changed = NULL;
+static int changedCount = 0;
+static int changedSize = 0;
+
+
+/*
+ * onInterrupt(sig) -- Signal handler that ends the watch loop.
+ */
+static void onInterrupt(int sig) {
+
+	(void)sig;
+	stopWatching = 1;
+}
+
+
+/*
+ * watchPrefix(name, len) -- Adds a watch on the directory of the first `len` bytes of
+ * `name` (the part up to and including its last `/`, or the current directory), unless
+ * that prefix is already watched.
+ */
+static void watchPrefix(const char *name, size_t len) {
+
+	int index;
+	for (index = 0; index < dirCount; index++) {
+		if (strlen(dirs[index].prefix) == len && strncmp(dirs[index].prefix, name, len) == 0) {
+			return;
+		}
+	}
+
+	char *prefix = malloc(len + 2);
+	if (prefix == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	memcpy(prefix, name, len);
+	prefix[len] = 0;
+
+	int wd = inotify_add_watch(notifyFd, len ? prefix : ".", WATCH_MASK);
+	if (wd < 0) {
+		perror(len ? prefix : ".");
+		free(prefix);
+		return;
+	}
+
+	dirs = realloc(dirs, (dirCount + 1) * sizeof(struct watchDir));
+	if (dirs == NULL) {
+		freeLL();
+		fprintf(stderr, "Ran Out of Memory.\n");
+		exit(1);
+	}
+	dirs[dirCount].wd = wd;
+	dirs[dirCount].prefix = prefix;
+	dirCount++;
+}
+
+
+/*
+ * prefixLength(name) -- Returns the length of the directory part of `name`, including its last `/`.
+ */
+static size_t prefixLength(const char *name) {
+
+	const char *slash = strrchr(name, '/');
+	return slash ? (size_t)(slash - name + 1) : 0;
+}
+
+
+/*
+ * closeWatches() -- Removes every watch and closes the inotify instance.
+ */
+static void closeWatches() {
+
+	if (notifyFd >= 0) {
+		close(notifyFd);
+		notifyFd = -1;
+	}
+	while (dirCount > 0) {
+		free(dirs[--dirCount].prefix);
+	}
+	free(dirs);
+	dirs = NULL;
+}
+
+
+/*
+ * openWatches(makeFileName) -- Watches the directory of the makefile and of every leaf
+ * prerequisite reached by the last traversal. Directories are watched rather than the
+ * files themselves, so one watch covers all of a directory's files and a file replaced
+ * by an editor (written elsewhere and renamed over the old one) is still seen.
+ */
+static void openWatches(char *makeFileName) {
+
+	notifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (notifyFd < 0) {
+		perror("inotify_init1");
+		freeLL();
+		exit(1);
+	}
+
+	watchPrefix(makeFileName, prefixLength(makeFileName));
+
+	struct parentNode *cur;
+	for (cur = headLL; cur != NULL; cur = cur->next) {
+		if (graph.flags[cur->id].visited && !graph.flags[cur->id].target) {
+			watchPrefix(cur->name, prefixLength(cur->name));
+		}
+	}
+}
+
+
+/*
+ * addChanged(id) -- Remembers that the file of node `id` changed, once.
+ * Uses `completed` as the mark: it is set on every node the traversal reached.
+ */
+static void addChanged(int id) {
+
+	if (!graph.flags[id].completed) {
+		return;
+	}
+	graph.flags[id].completed = 0;
+
+	if (changedCount == changedSize) {
+		changedSize = changedSize ? changedSize * 2 : 64;
+		changed = realloc(changed, changedSize * sizeof(int));
+		if (changed == NULL) {
+			freeLL();
+			fprintf(stderr, "Ran Out of Memory.\n");
+			exit(1);
+		}
+	}
+	changed[changedCount++] = id;
+}
+
+
+/*
+ * readEvents(makeFileName) -- Reads every pending inotify event and collects the changed
+ * leaves that the goals depend on. Returns `1` if the makefile itself changed.
+ */
+static int readEvents(char *makeFileName) {
+
+	char buffer[64 * 1024] __attribute__((aligned(__alignof__(struct inotify_event))));
+	char name[4096];
+	int makeFileChanged = 0;
+	ssize_t len;
+
+	while ((len = read(notifyFd, buffer, sizeof(buffer))) > 0) {
+		char *at;
+
+		for (at = buffer; at < buffer + len; at += sizeof(struct inotify_event) + ((struct inotify_event *)at)->len) {
+			struct inotify_event *event = (struct inotify_event *)at;
+			int index;
+
+			if (event->len == 0) {
+				continue;
+			}
+			for (index = 0; index < dirCount; index++) {
+				if (dirs[index].wd != event->wd) {
+					continue;
+				}
+				snprintf(name, sizeof(name), "%s%s", dirs[index].prefix, event->name);
+
+				if (strcmp(name, makeFileName) == 0) {
+					makeFileChanged = 1;
+				}
+				struct parentNode *node = tableFind(name, strlen(name));
+				if (node != NULL && !graph.flags[node->id].target && graph.flags[node->id].visited) {
+					addChanged(node->id);
+				}
+			}
+		}
+	}
+	return makeFileChanged;
+}
+
+
+/*
+ * rebuildCone() -- Rebuilds what depends on the changed leaves. Each changed leaf is
+ * stat'ed again, then every node reachable from them through the reverse edges the last
+ * traversal kept is reset and given a count of the prerequisites it waits on inside the
+ * cone; everything outside the
+ * cone keeps its state from the last build. Nodes are queued in their original order.
+ * Returns `1` if a command failed, `-1` if a changed leaf no longer exists, and `0` otherwise.
+ */
+static int rebuildCone() {
+
+	int missing = 0;
+	int index;
+
+	for (index = 0; index < changedCount; index++) {
+		forgetStat(changed[index]);
+		if (statNode(changed[index]) != 0) {
+			perror(graph.nodes[changed[index]]->name);
+			missing = 1;
+		}
+	}
+	if (missing) {
+		for (index = 0; index < changedCount; index++) {
+			graph.flags[changed[index]].completed = 1;
+		}
+		return -1;
+	}
+
+	// `changed` grows into the whole cone; `completed == 0` marks its members.
+	int coneStart = changedCount;
+	for (index = 0; index < changedCount; index++) {
+		int id = changed[index];
+		int at;
+
+		graph.flags[id].mustBuild = graph.flags[id].phony;
+		graph.pending[id] = 0;
+		for (at = graph.parentStart[id]; at < graph.parentStart[id + 1]; at++) {
+			if (graph.flags[graph.parentIds[at]].visited && !graph.dropped[graph.parentEdge[at]]) {
+				addChanged(graph.parentIds[at]);
+			}
+		}
+	}
+
+	for (index = 0; index < changedCount; index++) {
+		int id = changed[index];
+		int at;
+
+		for (at = graph.parentStart[id]; at < graph.parentStart[id + 1]; at++) {
+			if (graph.flags[graph.parentIds[at]].visited && !graph.dropped[graph.parentEdge[at]]) {
+				graph.pending[graph.parentIds[at]]++;
+			}
+		}
+	}
+	for (index = 0; index < changedCount; index++) {
+		if (graph.pending[changed[index]] == 0) {
+			pushReady(changed[index]);
+		}
+	}
+
+	CMDSused = 0;
+	int failed = runJobs();
+	saveBuildDatabase();
+	saveHashCache();
+
+	for (index = 0; index < changedCount; index++) {
+		graph.flags[changed[index]].completed = 1;
+	}
+	if (statStats) {
+		fprintf(stderr, "rebuilt a cone of %d nodes from %d changed files\n", changedCount, coneStart);
+	}
+	return failed;
+}
+
+
+/*
+ * resetBuildState() -- Forgets everything the last build learned about every node,
+ * including stat results and the edges dropped for closing a cycle, so that the next
+ * `buildGoals` starts from scratch. Only `target`, `phony` and `restat` come from the makefile.
+ */
+static void resetBuildState() {
+
+	int id;
+
+	for (id = 0; id < graphSize; id++) {
+		struct nodeFlags *flags = &graph.flags[id];
+
+		flags->visited = 0;
+		flags->completed = 0;
+		flags->mustBuild = 0;
+		graph.pending[id] = 0;
+		forgetStat(id);
+	}
+	memset(graph.dropped, 0, graph.edgeCount);
+}
+
+
+/*
+ * parsesCleanly(fp) -- Returns whether the open makefile `fp` parses without a format
+ * error. The parser exits on such an error, so it runs in a forked copy of this process,
+ * which prints the error and leaves the graph here alone. `fp` is rewound afterwards.
+ */
+static int parsesCleanly(FILE *fp) {
+
+	int status;
+
+	// The child must not write out what is still buffered here a second time.
+	fflush(NULL);
+
+	pid_t pid = fork();
+	if (pid == 0) {
+		// Nor finish the trace file at exit.
+		traceFile = NULL;
+		freeLL();
+		parseMakeFileData(fp);
+		_exit(0);
+	}
+	if (pid < 0) {
+		perror("fork");
+		return 0;
+	}
+
+	while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+	}
+	rewind(fp);
+	return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+/*
+ * loadGoals(makeFileName, names, count, previous) -- Parses the makefile (or loads its
+ * graph cache) and returns the nodes of the `count` goals in `names`, or `NULL` if the
+ * makefile cannot be opened or lacks one of them. The previous graph, if any, is freed
+ * first, along with `previous`, the goals found in it. If the makefile has a format
+ * error, the previous graph is kept instead and `previous` is returned.
+ */
+static struct parentNode **loadGoals(char *makeFileName, char **names, int count, struct parentNode **previous) {
+
+	FILE *fp = fopen(makeFileName, "r");
+	if (fp == NULL) {
+		perror(makeFileName);
+		free(previous);
+		freeLL();
+		return NULL;
+	}
+	if (!graphCacheIsCurrent(makeFileName, fp) && !parsesCleanly(fp)) {
+		fprintf(stderr, "%s was not Loaded; Still Watching with the Previous Version.\n", makeFileName);
+		fclose(fp);
+		return previous;
+	}
+
+	free(previous);
+	freeLL();
+	if (!loadGraphCache(makeFileName, fp)) {
+		parseMakeFileData(fp);
+		saveGraphCache(makeFileName, fp);
+	}
+	fclose(fp);
+
+	return findGoals(names, count);
+}
+
+
+/*
+ * buildAndReport(targets, names, count) -- Runs a full build of the `count` goals and
+ * reports the result. Returns `1` if a command failed and `0` otherwise.
+ */
+static int buildAndReport(struct parentNode **targets, char **names, int count) {
+
+	CMDSused = 0;
+	int failed = buildGoals(targets, count);
+
+	if (failed) {
+		fprintf(stderr, "Invalid Command was Given.\n");
+	} else {
+		reportUpToDate(names, targets, count);
+	}
+	fflush(stdout);
+	return failed;
+}
+
+
+/*
+ * watchGoals(makeFileName, names, count) -- Builds the `count` goals in `names` from the
+ * graph already parsed from `makeFileName`, then keeps rebuilding them as their sources
+ * change until interrupted. Changes are collected until none arrive for `WATCH_SETTLE_MS`
+ * milliseconds, so a save that touches several files starts one rebuild. After a failed
+ * command the next change triggers a full build, since targets outside the cone may still
+ * be out of date. Returns `0` when interrupted.
+ */
+int watchGoals(char *makeFileName, char **names, int count) {
+
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = onInterrupt;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	struct parentNode **targets = findGoals(names, count);
+	if (targets == NULL) {
+		freeLL();
+		exit(1);
+	}
+
+	int needFullBuild = buildAndReport(targets, names, count);
+	openWatches(makeFileName);
+	printf("Watching %d directories for changes.\n", dirCount);
+	fflush(stdout);
+
+	while (!stopWatching) {
+		struct pollfd waitFor = {notifyFd, POLLIN, 0};
+
+		if (poll(&waitFor, 1, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			break;
+		}
+
+		// Let a burst of events settle before rebuilding.
+		int makeFileChanged = 0;
+		do {
+			makeFileChanged |= readEvents(makeFileName);
+		} while (!stopWatching && poll(&waitFor, 1, WATCH_SETTLE_MS) > 0);
+
+		if (stopWatching) {
+			break;
+		}
+
+		struct timespec start;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+
+		if (makeFileChanged || targets == NULL) {
+			struct parentNode **previous = targets;
+
+			changedCount = 0;
+			closeWatches();
+			targets = loadGoals(makeFileName, names, count, previous);
+			if (targets != NULL && targets == previous) {
+				// Changes that came with the makefile were not looked at.
+				needFullBuild = 1;
+			} else if (targets != NULL) {
+				needFullBuild = buildAndReport(targets, names, count);
+			}
+			openWatches(makeFileName);
+		} else if (needFullBuild && changedCount > 0) {
+			changedCount = 0;
+			resetBuildState();
+			needFullBuild = buildAndReport(targets, names, count);
+		} else if (changedCount > 0) {
+			int result = rebuildCone();
+
+			changedCount = 0;
+			if (result > 0) {
+				fprintf(stderr, "Invalid Command was Given.\n");
+				needFullBuild = 1;
+			} else if (result == 0) {
+				reportUpToDate(names, targets, count);
+			}
+			fflush(stdout);
+		} else {
+			continue;
+		}
+		tracePhase("watch rebuild", &start);
+
+		if (statStats) {
+			fprintf(stderr, "rebuild took %.3f ms\n", elapsedNanos(&start) / 1e6);
+		}
+	}
+
+	closeWatches();
+	free(changed);
+	changed = NULL;
+	changedSize = 0;
+	free(targets);
+	freeLL();
+	return 0;
+}